@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Microbenchmarks of the hot paths, run on s51 (ucsim) by "make bench".
+ *
+ * Each case is timed by Timer0, which counts 8051 machine cycles (12 clocks),
+ * and reported through the UART as "<name> <bytes> <cycles>" per line.
+ * The cycle counts are those of the classic 8051 core simulated by s51,
+ * not of CIP-51; they are for comparison between revisions.
+ * Other devices on the GPIB bus are emulated by gpib_io_bench_poll(),
+ * which gpib_io.c built with GPIB_IO_BENCH calls while waiting for handshake lines.
+ */
+
+#include <string.h>
+
+#include "c8051f380.h"
+#include "main.h"
+#include "gpib.h"
+#include "gpib_io.h"
+#include "parser.h"
+#include "bench_usb.h"
+
+#define DAV 0x08
+#define NRFD 0x10
+#define NDAC 0x20
+#define EOI 0x04
+
+#define BENCH_GPIB_BYTES 256
+#define BENCH_USB_PACKETS 16
+
+static __xdata u8 buf[BENCH_GPIB_BYTES];
+
+// ---- cycle counter ----
+
+static volatile __data u16 t0_overflows;
+
+void interrupt_timer0() __interrupt (INTERRUPT_TIMER0) {
+  t0_overflows++;
+}
+
+static void cycles_start(){
+  TR0 = 0;
+  TH0 = TL0 = 0;
+  t0_overflows = 0;
+  TR0 = 1;
+}
+
+static u32 cycles_stop(){
+  u32 res;
+  TR0 = 0;
+  res = t0_overflows;
+  res <<= 16;
+  res |= ((u16)TH0 << 8) | TL0;
+  return res;
+}
+
+// ---- report through UART ----
+
+static void uart_putc(char c){
+  while(!TI0);
+  TI0 = 0;
+  SBUF0 = c;
+}
+
+static void uart_puts(const char *str){
+  while(*str){uart_putc(*(str++));}
+}
+
+static void uart_put_u32(u32 v){
+  char digits[10];
+  u8 i = 0;
+  do{
+    digits[i++] = '0' + (v % 10);
+    v /= 10;
+  }while(v > 0);
+  while(i > 0){uart_putc(digits[--i]);}
+}
+
+static void report(const char *name, u16 bytes, u32 cycles){
+  uart_puts(name);
+  uart_putc(' ');
+  uart_put_u32(bytes);
+  uart_putc(' ');
+  uart_put_u32(cycles);
+  uart_putc('\n');
+}
+
+// ---- virtual talker and acceptor ----
+
+static __xdata u16 talker_remain;
+static __xdata u16 accepted;
+static __bit acceptor;
+
+void gpib_io_bench_poll(){
+  if(acceptor){
+    if(P2 & DAV){ // ready for the next byte
+      P2 &= ~NDAC;
+      P2 |= NRFD;
+    }else if(P2 & NRFD){ // take the byte on the data lines
+      if(P1 == (u8)~'A'){accepted++;}
+      P2 &= ~NRFD;
+      P2 |= NDAC;
+    }
+    return;
+  }
+  if(talker_remain == 0){return;}
+  if(P2 & DAV){
+    if((P2 & (NRFD | NDAC)) == NRFD){ // some listener is ready for data
+      P1 = ~'A';
+      if(talker_remain == 1){P2 &= ~EOI;}
+      P2 &= ~DAV;
+    }
+  }else if(P2 & NDAC){ // accepted by all listeners
+    P2 |= (DAV | EOI);
+    P1 = 0xFF;
+    talker_remain--;
+  }
+}
+
+static __xdata u16 pushed;
+
+static void push(char c){
+  pushed++;
+}
+
+// ---- cases ----
+
+static void bench_write(){
+  u32 cycles;
+  memset(buf, 'A', sizeof(buf));
+  accepted = 0;
+  acceptor = TRUE;
+  cycles_start();
+  gpib_write(buf, sizeof(buf), GPIB_WRITE_USE_EOI);
+  cycles = cycles_stop();
+  acceptor = FALSE;
+  report("write", accepted, cycles);
+}
+
+static void bench_read(){
+  u32 cycles;
+  talker_remain = BENCH_GPIB_BYTES;
+  pushed = 0;
+  cycles_start();
+  gpib_read(push, GPIB_READ_UNTIL_EOI);
+  cycles = cycles_stop();
+  report("read", pushed, cycles);
+}
+
+static void bench_parse(){
+  static const __code char lines[]
+      = "++read_tmo_ms 1000\n++eos 3\n++eoi 1\n++eot_char 10\n";
+  u32 cycles;
+  const __code char *c;
+  cycles_start();
+  for(c = lines; *c; ++c){parse(*c);}
+  cycles = cycles_stop();
+  report("parse", sizeof(lines) - 1, cycles);
+}
+
+static void bench_usb(){
+  u32 cycles;
+  u8 i;
+
+  cycles_start();
+  for(i = 0; i < BENCH_USB_PACKETS; ++i){
+    bench_fifo_write(buf, CDC_DATA_EP_IN_PACKET_SIZE);
+  }
+  cycles = cycles_stop();
+  report("fifo_write", CDC_DATA_EP_IN_PACKET_SIZE * BENCH_USB_PACKETS, cycles);
+
+  {
+    u16 bytes = 0;
+    cycles_start();
+    for(i = 0; i < BENCH_USB_PACKETS; ++i){
+      bytes += bench_cdc_tx_fill(buf);
+    }
+    cycles = cycles_stop();
+    report("cdc_tx", bytes, cycles);
+  }
+}
+
+void main(){
+  // Timer0 for cycle count, Timer1 for UART baudrate
+  TMOD = 0x21; // T1: 8-bit auto reload, T0: 16-bit
+  TH1 = 0xFF;
+  TR1 = 1;
+  SCON0 = 0x52; // mode 1, TI0 set
+  ET0 = 1;
+  EA = 1;
+
+  gpib_init();
+
+  bench_write();
+  bench_read();
+  bench_parse();
+  bench_usb();
+
+  uart_puts("done\n");
+  __asm
+    .db 0xA5 ; undefined instruction, which stops s51
+  __endasm;
+  while(1);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * USB copy paths for the benchmark, compiled with f38x_usb.c and usb_cdc.c
+ * in this translation unit to call their static functions and variables.
+ * The transfer with the SIE itself is out of scope, because s51 has no USB0;
+ * fifo_read_C() is not measured since its BUSY wait never finishes on s51.
+ */
+
+#include "../f38x_usb.c"
+#include "../usb_cdc.c"
+
+#include "bench_usb.h"
+
+u16 bench_fifo_write(u8 *buf, u16 size){
+  write_target_t target;
+  target.array = buf;
+  return fifo_write_C(&target, size, CDC_DATA_EP_IN);
+}
+
+u16 bench_cdc_tx_fill(u8 *buf){
+  u16 res = 0;
+  margin = sizeof(tx_packet) - TX_BUF_HEADER;
+  while(margin > 1){
+    res += cdc_tx(buf++, 1);
+  }
+  return res;
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Run the benchmark image on s51 and compare cycles per byte with the baseline.
+# usage: run_bench.sh image.ihx baseline_file [threshold_percent]
+# BENCH_UPDATE=1 (re)writes the baseline; otherwise a missing baseline, or a case
+# without its entry, is an error.
+# With "-" as the baseline, the results are only printed.
+
+IMAGE=$1
+BASELINE=$2
+THRESHOLD=${3:-5}
+: ${S51:=s51}
+
+RESULT=$(mktemp)
+trap 'rm -f ${RESULT}' EXIT
+
+printf 'run\nquit\n' | timeout 600 ${S51} -t 8052 -S in=/dev/null,out=${RESULT} ${IMAGE} > /dev/null
+if ! grep -q '^done' ${RESULT}; then
+  echo "benchmark did not finish:"
+  cat ${RESULT}
+  exit 1
+fi
+
+if [ "${BASELINE}" = "-" ]; then
+  awk '$3 != "" {printf("%-12s %6d bytes %10d cycles %8.2f cycles/byte\n", $1, $2, $3, $3 / $2)}' ${RESULT}
+  exit 0
+fi
+
+if [ "${BENCH_UPDATE}" = "1" ]; then
+  {
+    echo "# <case> <cycles per byte> on s51, updated by \"make bench-baseline\""
+    awk '$3 != "" {printf("%s %.2f\n", $1, $3 / $2)}' ${RESULT}
+  } > ${BASELINE}
+  echo "baseline saved to ${BASELINE}"
+  cat ${BASELINE}
+  exit 0
+fi
+
+if [ ! -f ${BASELINE} ]; then
+  echo "baseline ${BASELINE} not found, run with BENCH_UPDATE=1 to create it"
+  exit 1
+fi
+
+awk -v threshold=${THRESHOLD} '
+  FNR == NR {if($1 !~ /^#/){base[$1] = $2}; next}
+  $3 == "" {next}
+  {
+    cpb = $3 / $2
+    mark = ""
+    if(!($1 in base)){
+      mark = " NO BASELINE"
+      failed = 1
+    }else if(cpb > base[$1] * (1 + threshold / 100)){
+      mark = " REGRESSED"
+      failed = 1
+    }
+    printf("%-12s %6d bytes %10d cycles %8.2f cycles/byte (baseline %s)%s\n",
+        $1, $2, $3, cpb, ($1 in base) ? base[$1] : "-", mark)
+  }
+  END {exit failed}' ${BASELINE} ${RESULT}
@@ -0,0 +1,33 @@
+/* Generated by gen_command_hash.sh from command_str[] of parser.c; do not edit. */
+
+#ifndef __COMMAND_HASH_H__
+#define __COMMAND_HASH_H__
+
+#define COMMAND_HASH_COMMANDS 32
+#define COMMAND_HASH_A 2
+#define COMMAND_HASH_B 51
+#define COMMAND_HASH_MASK 0x7F
+#define command_hash(str, len) \
+  ((u8)((u8)(str)[1] * COMMAND_HASH_A + (u8)(str)[(len) - 1] * COMMAND_HASH_B + (len)) & COMMAND_HASH_MASK)
+
+// index of command_str[], 0xFF means none
+static const __code u8 command_hash_table[COMMAND_HASH_MASK + 1] = {
+  0xFF, 0x0B, 0x00, 0x14, 0xFF, 0x0E, 0xFF, 0x05,
+  0x07, 0xFF, 0x1E, 0x01, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x02, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0x09, 0xFF, 0x06, 0xFF, 0x15, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x1B, 0xFF, 0xFF, 0xFF, 0x18,
+  0xFF, 0xFF, 0x0C, 0xFF, 0x19, 0xFF, 0x0D, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0x04, 0x0A, 0x03, 0xFF, 0x0F, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0x16, 0xFF, 0x1C, 0x12,
+  0xFF, 0xFF, 0x17, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0x1F, 0xFF, 0xFF, 0xFF,
+  0x1A, 0x10, 0x11, 0xFF, 0x13, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0x1D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0x08, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+#endif /* __COMMAND_HASH_H__ */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "config_store.h"
+#include "f38x_flash.h"
+
+#define SLOTS_PER_PAGE (FLASH_PAGESIZE / CONFIG_STORE_SLOT_SIZE)
+#define SLOTS (SLOTS_PER_PAGE * CONFIG_STORE_PAGES)
+#define NO_SLOT 0xFF
+#define SEQUENCE_EMPTY 0xFFFF // erased
+#define CHECKSUM_SEED 0x5A // sum of all bytes of a valid record, which rejects a zero-filled slot
+
+typedef struct {
+  u16 sequence;
+  u8 key;
+  u8 size;
+} config_record_header_t;
+
+#if defined(__SDCC) || defined(SDCC)
+#define store ((u8 __code *)CONFIG_STORE_ADDRESS)
+#else
+static u8 store[CONFIG_STORE_PAGES * FLASH_PAGESIZE]; // host build, whose flash is emulated
+#endif
+
+#define slot_ptr(i) (store + ((u16)(i) * CONFIG_STORE_SLOT_SIZE))
+#define page_of(slot) ((slot) / SLOTS_PER_PAGE)
+
+static __xdata config_record_header_t header;
+static __xdata u8 latest[CONFIG_STORE_KEYS]; // slot of the latest record of each key
+static __xdata u8 next_slot;
+static __xdata u16 next_sequence;
+static __xdata enum { // of the background save, see config_store_polling()
+  JOB_IDLE,
+  JOB_PREPARE, // look for the slot, erase the page when wrapped, and relocate
+  JOB_PAYLOAD, // written by CONFIG_STORE_CHUNK bytes
+  JOB_FINISH, // checksum and header
+} job = JOB_IDLE;
+
+static u8 sum(u8 *p, u8 size){
+  u8 res = 0;
+  while(size--){res += *(p++);}
+  return res;
+}
+
+static u8 slot_erased(u8 __code *p){
+  u8 i;
+  for(i = 0; i < CONFIG_STORE_SLOT_SIZE; ++i){
+    if(p[i] != 0xFF){return FALSE;}
+  }
+  return TRUE;
+}
+
+static void advance(){
+  if(++next_slot >= SLOTS){next_slot = 0;}
+  if(++next_sequence == SEQUENCE_EMPTY){next_sequence = 0;}
+}
+
+/**
+ * Scan the log for the latest valid record of each key,
+ * and the slot and sequence number for the next save.
+ */
+void config_store_init(){
+  u8 i, newest = NO_SLOT;
+  u16 newest_sequence;
+  job = JOB_IDLE; // a save interrupted by reset is left partially written
+  memset(latest, NO_SLOT, sizeof(latest));
+  for(i = 0; i < SLOTS; ++i){
+    u8 __code *p = slot_ptr(i);
+    memcpy(&header, p, sizeof(header));
+    if((header.sequence == SEQUENCE_EMPTY)
+        || (header.key >= CONFIG_STORE_KEYS)
+        || (header.size > CONFIG_STORE_PAYLOAD_MAX)){continue;}
+    if(sum(p, sizeof(header) + header.size + 1) != CHECKSUM_SEED){continue;} // broken
+    if(latest[header.key] != NO_SLOT){
+      u16 sequence;
+      memcpy(&sequence, slot_ptr(latest[header.key]), sizeof(sequence));
+      if((s16)(header.sequence - sequence) < 0){continue;} // older
+    }
+    latest[header.key] = i;
+    if((newest == NO_SLOT) || ((s16)(header.sequence - newest_sequence) > 0)){
+      newest = i;
+      newest_sequence = header.sequence;
+    }
+  }
+  if(newest == NO_SLOT){
+    next_slot = 0;
+    next_sequence = 0;
+  }else{
+    next_slot = newest;
+    next_sequence = newest_sequence;
+    advance();
+  }
+}
+
+u8 config_store_has(u8 key){
+  return (key < CONFIG_STORE_KEYS) && (latest[key] != NO_SLOT);
+}
+
+// @return payload size of the latest record of the key, or 0 when not found
+u8 config_store_size(u8 key){
+  if(!config_store_has(key)){return 0;}
+  return ((config_record_header_t __code *)slot_ptr(latest[key]))->size; // header is kept for the save in progress
+}
+
+/**
+ * Load the payload of the latest record of the key.
+ * A save in progress is not visible until it completes,
+ * so call config_store_flush() first when the key may be being saved.
+ * @return TRUE when found, otherwise dst is untouched
+ */
+u8 config_store_load(u8 key, void *dst, u8 size){
+  u8 __code *p;
+  if((key >= CONFIG_STORE_KEYS) || (latest[key] == NO_SLOT)){return FALSE;}
+  p = slot_ptr(latest[key]);
+  if(((config_record_header_t __code *)p)->size != size){return FALSE;} // header is kept for the save in progress
+  memcpy(dst, p + sizeof(header), size);
+  return TRUE;
+}
+
+/*
+ * A save is a background job; the snapshot of the payload is written
+ * in steps by config_store_polling(), each of which keeps interrupts
+ * disabled for a short time only, between the transfers.
+ * Before the log wraps around to a page, the latest records in it are
+ * copied (relocated) to the current page, so that erasing it loses no key.
+ * This requires CONFIG_STORE_KEYS < FLASH_PAGESIZE / CONFIG_STORE_SLOT_SIZE.
+ */
+static __xdata u8 pending_key, pending_size;
+static __xdata u8 snapshot[CONFIG_STORE_PAYLOAD_MAX];
+static u8 * __xdata source; // snapshot, or the payload of the record to be relocated
+static __xdata u8 written, checksum;
+
+/**
+ * Request to append a record of the key to the log; the payload is copied,
+ * and written by the following config_store_polling().
+ * The previous request, if any, is completed first.
+ */
+void config_store_save(u8 key, void *src, u8 size){
+  if((key >= CONFIG_STORE_KEYS) || (size > CONFIG_STORE_PAYLOAD_MAX)){return;}
+  config_store_flush();
+  memcpy(snapshot, src, size);
+  pending_key = key;
+  pending_size = size;
+  job = JOB_PREPARE;
+}
+
+u8 config_store_busy(){
+  return job != JOB_IDLE;
+}
+
+static void prepare(){
+  u8 i, page, free, relocate = NO_SLOT, remain = 0;
+
+  while(1){
+    if((next_slot % SLOTS_PER_PAGE) == 0){ // wrapped to the page, whose latest records are relocated already
+      flash_erase_page((flash_address_t)slot_ptr(next_slot));
+    }
+    if(slot_erased(slot_ptr(next_slot))){break;}
+    advance(); // skip a slot written partially, which leaves one less free slot below
+  }
+
+  // keys to be relocated from the next page, except for the one to be saved now
+  page = page_of(next_slot) + 1;
+  if(page >= CONFIG_STORE_PAGES){page = 0;}
+  for(i = 0; i < CONFIG_STORE_KEYS; ++i){
+    if((latest[i] == NO_SLOT) || (page_of(latest[i]) != page) || (i == pending_key)){continue;}
+    relocate = latest[i];
+    remain++;
+  }
+  free = SLOTS_PER_PAGE - (next_slot % SLOTS_PER_PAGE);
+
+  if((relocate != NO_SLOT) && (free <= remain + 1)){
+    u8 __code *p = slot_ptr(relocate);
+    memcpy(&header, p, sizeof(header));
+    source = p + sizeof(header);
+  }else{
+    header.key = pending_key;
+    header.size = pending_size;
+    source = snapshot;
+  }
+  header.sequence = next_sequence;
+  checksum = CHECKSUM_SEED - sum((u8 *)&header, sizeof(header)) - sum(source, header.size);
+  written = 0;
+  job = JOB_PAYLOAD;
+}
+
+/**
+ * Perform one step of the save; the header is written last,
+ * so that an interrupted save leaves the slot invisible.
+ */
+void config_store_polling(){
+  switch(job){
+    case JOB_PREPARE:
+      prepare();
+      break;
+    case JOB_PAYLOAD: {
+      u8 size = header.size - written;
+      if(size > CONFIG_STORE_CHUNK){size = CONFIG_STORE_CHUNK;}
+      flash_write((flash_address_t)(slot_ptr(next_slot) + sizeof(header) + written), source + written, size);
+      written += size;
+      if(written >= header.size){job = JOB_FINISH;}
+      break;
+    }
+    case JOB_FINISH:
+      flash_write((flash_address_t)(slot_ptr(next_slot) + sizeof(header) + header.size), &checksum, 1);
+      flash_write((flash_address_t)slot_ptr(next_slot), (u8 *)&header, sizeof(header));
+      latest[header.key] = next_slot;
+      advance();
+      job = (source == snapshot) ? JOB_IDLE : JOB_PREPARE; // the requested one after relocation
+      break;
+    case JOB_IDLE:
+      break;
+  }
+}
+
+// Complete the save in progress, for example before reset
+void config_store_flush(){
+  while(job != JOB_IDLE){config_store_polling();}
+}
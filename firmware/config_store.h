@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __CONFIG_STORE_H__
+#define __CONFIG_STORE_H__
+
+#include "type.h"
+
+/*
+ * Append-only log of configuration records in flash, for wear leveling.
+ * Each record occupies one slot; a sequence number, the key, the payload size,
+ * the payload, and a checksum. The latest record of each key is valid.
+ * Records are appended to the slots in turn,
+ * and a page is erased only when the log wraps around to it,
+ * i.e., once per (FLASH_PAGESIZE / CONFIG_STORE_SLOT_SIZE) saves.
+ * The page 0x7e00-0x7fff is not used because it holds the lock byte.
+ */
+#define CONFIG_STORE_ADDRESS 0x7a00
+#define CONFIG_STORE_PAGES 2
+#define CONFIG_STORE_SLOT_SIZE 64
+#define CONFIG_STORE_PAYLOAD_MAX (CONFIG_STORE_SLOT_SIZE - 5) // sequence(2), key(1), size(1) and checksum(1)
+#define CONFIG_STORE_CHUNK 8 // bytes written in a step of the background save
+
+#define CONFIG_STORE_KEY_BOOT 0 // ++savecfg
+#define CONFIG_STORE_KEY_PROFILE(n) (1 + (n)) // ++profile save <n>
+#define CONFIG_STORE_PROFILES 4
+#define CONFIG_STORE_KEY_MACRO(n) (1 + CONFIG_STORE_PROFILES + (n)) // ++macro def <n>
+#define CONFIG_STORE_MACROS 2
+#define CONFIG_STORE_KEYS (1 + CONFIG_STORE_PROFILES + CONFIG_STORE_MACROS) // < FLASH_PAGESIZE / CONFIG_STORE_SLOT_SIZE
+
+void config_store_init();
+u8 config_store_has(u8 key);
+u8 config_store_size(u8 key);
+u8 config_store_load(u8 key, void *dst, u8 size);
+void config_store_save(u8 key, void *src, u8 size);
+u8 config_store_busy();
+void config_store_polling();
+void config_store_flush();
+
+#endif /* __CONFIG_STORE_H__ */
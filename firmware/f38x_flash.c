@@ -158,66 +158,3 @@ u16 flash_write(flash_address_t dst, u8 *src, u16 size){
   }while(0);
   return size_orig;
 }
-
-static void page_copy(flash_address_t dst, flash_address_t src){
-  flash_erase_page(dst);
-  flash_write(dst, (u8 __code *)src, FLASH_PAGESIZE);
-}
-
-u16 flash_update(flash_address_t dst, u8 *src, u16 size){
-  flash_address_t dst_align = dst & ~((flash_address_t)FLASH_PAGESIZE - 1);
-  u16 size_orig = size;
-
-  if((size > 0) && (dst_align != dst)){ // first page
-    u16 copy1_size = dst - dst_align;
-    u16 copy2_size = FLASH_PAGESIZE - copy1_size;
-    u16 copy3_size;
-    if(copy2_size > size){
-      copy3_size = copy2_size - size;
-      copy2_size = size;
-    }else{
-      copy3_size = 0;
-    }
-
-    // check requirement for copy
-    if(check_erased(dst_align, copy1_size)
-        && check_erased(dst_align + FLASH_PAGESIZE - copy3_size, copy3_size)){
-      copy1_size = 0;
-      copy3_size = 0;
-    }else{
-      page_copy(FLASH_SCRATCH_PAGE, dst_align);
-    }
-
-    flash_erase_page(dst_align);
-    flash_write(dst_align, (u8 __code *)FLASH_SCRATCH_PAGE, copy1_size);
-    flash_write(dst, src, copy2_size);
-    dst += copy2_size;
-    src += copy2_size;
-    size -= copy2_size;
-    flash_write(dst, (u8 __code *)(FLASH_SCRATCH_PAGE + FLASH_PAGESIZE - copy3_size), copy3_size);
-  }
-
-  while(size >= FLASH_PAGESIZE){ // updating intermediate pages every page
-    flash_erase_page(dst);
-    flash_write(dst, src, FLASH_PAGESIZE);
-    dst += FLASH_PAGESIZE;
-    src += FLASH_PAGESIZE;
-    size -= FLASH_PAGESIZE;
-  }
-
-  if(size > 0){ // last page
-    u16 copy_size = FLASH_PAGESIZE - size;
-    if(check_erased(dst + size, copy_size)){
-      copy_size = 0;
-    }else{
-      page_copy(FLASH_SCRATCH_PAGE, dst);
-    }
-
-    flash_erase_page(dst);
-    flash_write(dst, src, size);
-    dst += size;
-    flash_write(dst, (u8 __code *)(FLASH_SCRATCH_PAGE + size), copy_size);
-  }
-
-  return size_orig;
-}
@@ -35,12 +35,14 @@
 #include "type.h"
 
 #define FLASH_PAGESIZE 512
-#define FLASH_SCRATCH_PAGE 0x7c00
 
+#if defined(__SDCC) || defined(SDCC)
 typedef UINT flash_address_t;
+#else
+typedef unsigned long flash_address_t; // host build, holds a pointer
+#endif
 
 void flash_erase_page(flash_address_t addr);
 u16 flash_write(flash_address_t dst, u8 *src, u16 size);
-u16 flash_update(flash_address_t dst, u8 *src, u16 size);
 
 #endif /* __F38X_FLASH_H__ */
@@ -44,6 +44,7 @@
 #include "usb_cdc.h"
 
 #include "util.h"
+#include "stats.h"
 
 // Holds the current USB State
 usb_state_t usb_state;
@@ -136,10 +137,9 @@ static unsigned int fifo_read_C(
       // Copy data byte
       *(ptr_data++) = USB0DAT;
     }else{
-      volatile BYTE c;
       while(--read_count){
-        // Copy data byte
-        c = USB0DAT;
+        // Discard data byte, the read itself advances the FIFO
+        (void)(BYTE)USB0DAT;
         
         // Wait for BUSY->'0' (data ready)
         while(USB0ADR & 0x80);              
@@ -148,8 +148,8 @@ static unsigned int fifo_read_C(
       // Clear auto-read
       USB0ADR &= ~0x40;
 
-      // Copy data byte
-      c = USB0DAT;
+      // Discard data byte
+      (void)(BYTE)USB0DAT;
     }
   }
   
@@ -517,8 +517,7 @@ void usb0_init(){
 
   if(REG01CN & 0x40){
     usb_mode = USB_CABLE_CONNECTED;
-    enable_phy();
-    wait_ms(100);
+    enable_phy(); // the host starts enumeration after its debounce, without waiting here
   }else{
     usb_mode = USB_INACTIVE;
   }
@@ -724,6 +723,7 @@ void usb_polling(){
       break;
     case USB_CDC_READY:
       usb_mode = USB_CDC_ACTIVE;
+      stats_enumerated();
       break;
     case USB_CDC_ACTIVE:
       cdc_polling();
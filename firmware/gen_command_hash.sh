@@ -0,0 +1,68 @@
+#!/bin/sh
+# Generate command_hash.h, the perfect hash of command_str[] in parser.c for check_cmd().
+# usage: gen_command_hash.sh parser.c > command_hash.h
+# The hash is (str[1] * A + str[len - 1] * B + len) & MASK, whose A and B are searched
+# so that every command has its own entry; check_cmd() then needs only one memcmp().
+# The table (MASK + 1 entries) is widened when no pair is found.
+# The output has CRLF line endings, as the other sources.
+
+awk '
+  function search(mask){
+    for(a = 1; a < 256; a++){
+      for(b = 1; b < 256; b++){
+        split("", used)
+        for(i = 0; i < n; i++){
+          str = name[i]
+          len = length(str)
+          h = (ord[substr(str, 2, 1)] * a + ord[substr(str, len, 1)] * b + len) % 256 % (mask + 1)
+          if(h in used){break}
+          used[h] = i
+        }
+        if(i == n){return 1}
+      }
+    }
+    return 0
+  }
+  BEGIN {
+    ORS = "\r\n"
+    for(i = 32; i < 127; i++){ord[sprintf("%c", i)] = i}
+  }
+  /command_str\[\] = \{/ {in_list = 1; next}
+  in_list && /^\};/ {in_list = 0}
+  in_list && match($0, /"[^"]*"/) {
+    name[n++] = substr($0, RSTART + 1, RLENGTH - 2)
+  }
+  END {
+    if(n == 0){print "no command found" > "/dev/stderr"; exit 1}
+    # the smallest table up to 256 entries
+    for(mask = 63; mask < 256; mask = mask * 2 + 1){
+      if(search(mask)){break}
+    }
+    if(mask >= 256){print "no perfect hash found" > "/dev/stderr"; exit 1}
+
+    print "/* Generated by gen_command_hash.sh from command_str[] of parser.c; do not edit. */"
+    print ""
+    print "#ifndef __COMMAND_HASH_H__"
+    print "#define __COMMAND_HASH_H__"
+    print ""
+    printf("#define COMMAND_HASH_COMMANDS %d\r\n", n)
+    printf("#define COMMAND_HASH_A %d\r\n", a)
+    printf("#define COMMAND_HASH_B %d\r\n", b)
+    printf("#define COMMAND_HASH_MASK 0x%02X\r\n", mask)
+    print "#define command_hash(str, len) \\"
+    print "  ((u8)((u8)(str)[1] * COMMAND_HASH_A + (u8)(str)[(len) - 1] * COMMAND_HASH_B + (len)) & COMMAND_HASH_MASK)"
+    print ""
+    print "// index of command_str[], 0xFF means none"
+    print "static const __code u8 command_hash_table[COMMAND_HASH_MASK + 1] = {"
+    for(h = 0; h <= mask; h += 8){
+      line = " "
+      for(i = h; i < h + 8; i++){
+        line = line sprintf(" 0x%02X,", (i in used) ? used[i] : 255)
+      }
+      print line
+    }
+    print "};"
+    print ""
+    print "#endif /* __COMMAND_HASH_H__ */"
+  }
+' "$1"
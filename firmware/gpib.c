@@ -36,11 +36,13 @@
 #include "c8051f380.h"
 #include "usb_cdc.h"
 #include "util.h"
-#include "f38x_flash.h"
+#include "config_store.h"
+#include "stats.h"
+#include "xram.h"
 
 #include <string.h>
 
-static __code __at (0x7a00) gpib_config_struct gpib_config_saved = {
+static __code gpib_config_struct gpib_config_default = { // unless saved by ++savecfg
   {{{0},}, 0,}, // address
   0, // read_after_write
   0, // eoi
@@ -60,8 +62,14 @@ gpib_config_t gpib_config;
 #define DEBUG_GPIB_ECHO 0x02
 #define DEBUG_VERBOSE 0x04
 
+#ifdef GPIB_NO_DEBUG_ECHO
+#define debug_echo(flag) FALSE // removed from the hot paths by the build
+#else
+#define debug_echo(flag) (gpib_config.debug & (flag))
+#endif
+
 #define print_str(str) write(str, sizeof(str) - 1)
-static void print_terminator(u16 (*write)(char *buf, u16 len)){
+static void print_terminator(u16 (*write)(const char *buf, u16 len)){
   switch(gpib_config.eos){
     case 0: print_str("\r\n"); break;
     case 1: print_str("\r"); break;
@@ -70,7 +78,7 @@ static void print_terminator(u16 (*write)(char *buf, u16 len)){
 }
 #undef print_str
 
-static u16 (*write_func)(char *, u16) = (u16 (*)(char *, u16))cdc_tx;
+static u16 (*write_func)(const char *, u16) = (u16 (*)(const char *, u16))cdc_tx;
 static void push_func(char c){write_func(&c, 1);}
 
 #define print_str(str) write_func(str, sizeof(str) - 1)
@@ -94,7 +102,29 @@ static void print_u16(u16 v){
   write_func(&buf[i], sizeof(buf) - i);
 }
 
-static void print_address(enum commant_t cmd, __xdata address_t *address){
+static void print_u32(u32 v){
+  char buf[10];
+  u8 i = sizeof(buf);
+  while(1){
+    buf[--i] = '0' + (v % 10);
+    if(v < 10){break;}
+    v /= 10;
+  }
+  write_func(&buf[i], sizeof(buf) - i);
+}
+
+static void print_hex32(u32 v){
+  static const __code char hex[] = "0123456789abcdef";
+  char buf[8];
+  u8 i = sizeof(buf);
+  do{
+    buf[--i] = hex[(u8)v & 0x0F];
+    v >>= 4;
+  }while(i > 0);
+  write_func(buf, sizeof(buf));
+}
+
+static void print_address(enum command_t cmd, __xdata address_t *address){
   u8 i;
   if(gpib_config.debug & DEBUG_VERBOSE){
     print_header();
@@ -112,7 +142,7 @@ static void print_address(enum commant_t cmd, __xdata address_t *address){
   print_terminator(write_func);
 }
 
-static void print_1arg(enum commant_t cmd, u16 arg1){
+static void print_1arg(enum command_t cmd, u16 arg1){
   if(gpib_config.debug & DEBUG_VERBOSE){
     print_header();
     write_func(command_str[cmd], strlen(command_str[cmd]));
@@ -137,7 +167,7 @@ static void dump_config(){
 
 #define renew_arg0(type) \
 static u8 renew_arg0_ ## type(parsed_info_t *info, __xdata type *res, type max){ \
-  if((info->args > 0) && (info->arg[0] >= 0) && (info->arg[0] <= max)){ \
+  if((info->args > 0) && ((u16)info->arg[0] <= max)){ \
     type tmp = (type)info->arg[0]; \
     if(*res != tmp){ \
       *res = tmp; \
@@ -149,7 +179,7 @@ static u8 renew_arg0_ ## type(parsed_info_t *info, __xdata type *res, type max){
 renew_arg0(u8)
 renew_arg0(u16)
 
-static u8 check_address(__xdata int *buf, u8 size, u8 *res){
+static u8 check_address(__xdata s16 *buf, u8 size, u8 *res){
   u8 changes = 0;
   if((size > 0) && (buf[0] >= 0) && (buf[0] <= 30)){
     res[0] = buf[0];
@@ -164,11 +194,12 @@ static u8 check_address(__xdata int *buf, u8 size, u8 *res){
   return changes;
 }
 
-static __xdata address_t *get_address(parsed_info_t *info){
+static __xdata address_t *get_address(parsed_info_t *info, u8 i){
   static __xdata address_t address;
-  u8 i = 0;
   address.valid_items = 0;
-  while(info->args > 0){
+  info->args -= i;
+  while((info->args > 0)
+      && (address.valid_items < (sizeof(address.item) / sizeof(address.item[0])))){
     u8 captured = check_address(&(info->arg[i]), (u8)info->args, address.item[address.valid_items]);
     if(captured == 0){
       captured = 1; // skip invalid argument.
@@ -197,7 +228,7 @@ enum gpib_command_t {
 #define GPIB_CMD_TAD(x) (x | 0x40)
 #define GPIB_CMD_IS_TAD_OR_UNT(x) ((x & 0x60) == 0x40)
 
-static void gpib_cmd(u8 cmd, __xdata address_t *new_listener){
+static void gpib_cmd(u8 cmd, __xdata address_t *new_listener, u8 flags){
   gpib_uniline(GPIB_UNI_CMD_START);
   if(new_listener){
     u8 i;
@@ -209,11 +240,63 @@ static void gpib_cmd(u8 cmd, __xdata address_t *new_listener){
       }
     }
   }
-  gpib_putchar(cmd, 0);
+  gpib_putchar(cmd, flags);
+  gpib_uniline(GPIB_UNI_CMD_END);
+}
+
+/*
+ * When enabled by ++tstamp, each message read by gpib_read_from() is prefixed
+ * with the device time in microseconds (8 hex digits) when its first byte is accepted.
+ * The time is a u32, which wraps around every 2^32 us (about 71.6 minutes).
+ */
+static __xdata u8 tstamp_mode = 0;
+static __bit tstamp_pending;
+static __xdata char read_last; // the last byte of the message read by gpib_read_from()
+static void push_func_read(char c){
+  read_last = c;
+  push_func(c);
+}
+static void push_func_tstamp(char c){
+  if(tstamp_pending){
+    tstamp_pending = FALSE;
+    print_hex32(timestamp_to_us(&gpib_read_timestamp[0]));
+    print_space();
+  }
+  push_func_read(c);
+}
+
+static u16 gpib_read_from(__xdata u8 *talker, u8 flags){
+  u16 res;
+  gpib_uniline(GPIB_UNI_CMD_START);
+  gpib_putchar(GPIB_CMD_UNL, 0);
+  gpib_putchar(GPIB_CMD_LAD(0), 0); // listener, it's me.
+  gpib_putchar(GPIB_CMD_TAD(talker[0]), 0); // talker
+  if(talker[1] != 0){
+    gpib_putchar(talker[1], 0);
+  }
   gpib_uniline(GPIB_UNI_CMD_END);
+  if(tstamp_mode){
+    tstamp_pending = TRUE;
+    res = gpib_read(push_func_tstamp, flags | GPIB_READ_TIMESTAMP);
+  }else{
+    res = gpib_read(push_func_read, flags);
+  }
+  sys_state |= SYS_GPIB_LISTENED;
+  return res;
 }
 
-static u16 gpib_write_auto_eoi(char *buf, u16 length){
+/*
+ * Reads a reply following its tag (++tx tag, ++trg address or ++sched job),
+ * and keeps one line per tag even if the reply is ended by EOI only, partial or timed out.
+ */
+static void read_tagged(__xdata u8 *talker){
+  if((gpib_read_from(talker, 0) == 0)
+      || (read_last != ((gpib_config.eos == 1) ? '\r' : '\n'))){
+    print_terminator(write_func);
+  }
+}
+
+static u16 gpib_write_auto_eoi(const char *buf, u16 length){
   return gpib_write(buf, length,
       gpib_config.eoi ? GPIB_WRITE_USE_EOI : 0);
 }
@@ -226,10 +309,249 @@ static void force_end_talking(){
   }
 }
 
+/*
+ * Tagged transaction armed by ++tx, which is consumed by the next data line.
+ * The target is held in the static buffer of get_address(),
+ * therefore the transaction is canceled by any other command.
+ */
+static __bit tx_armed;
+static __xdata u16 tx_tag;
+static __xdata address_t *tx_target;
+
+static void tx_read(){
+  tx_armed = FALSE;
+  print_u16(tx_tag);
+  print_space();
+  read_tagged(tx_target->item[0]);
+}
+
+/*
+ * Periodic trigger (GET) and read jobs registered by ++sched,
+ * which are executed in gpib_polling() based on the Timer3 tick (10 ms).
+ */
+#define SCHED_JOBS 4
+typedef struct {
+  u8 item[2]; // talker address
+  u16 period; // [tick], 0 means unused
+  u16 next; // [tick]
+} sched_job_t;
+
+/*
+ * Buffers of the modes which never run at the same time (see xram.h);
+ * ++sched jobs in controller mode, and the ring of ++capture / ++sniff in device mode.
+ * Therefore, sched_init() is required whenever the mode is changed.
+ */
+static __xdata union {
+  sched_job_t sched_job[SCHED_JOBS];
+  u8 capture_ring[XRAM_MODE_ARENA]; // indexed by u8 for cheap wrap-around
+} mode_arena;
+#define sched_job (mode_arena.sched_job)
+#define capture_ring (mode_arena.capture_ring)
+
+static void sched_init(){
+  u8 i;
+  for(i = 0; i < SCHED_JOBS; ++i){
+    sched_job[i].period = 0;
+  }
+}
+
+#ifndef GPIB_DEVICE_ONLY
+static void sched_dump(){
+  u8 i;
+  for(i = 0; i < SCHED_JOBS; ++i){
+    if(sched_job[i].period == 0){continue;}
+    if(gpib_config.debug & DEBUG_VERBOSE){
+      print_header();
+      write_func(command_str[CMD_SCHED], strlen(command_str[CMD_SCHED]));
+      print_space();
+    }
+    print_u16(i);
+    print_space();
+    print_u32((u32)sched_job[i].period * 10);
+    print_space();
+    print_u16(sched_job[i].item[0]);
+    if(sched_job[i].item[1] > 0){
+      print_space();
+      print_u16(sched_job[i].item[1]);
+    }
+    print_terminator(write_func);
+  }
+}
+
+static void sched_polling(){
+  u8 i;
+  u16 now;
+  u32 stamp;
+  for(i = 0; i < SCHED_JOBS; ++i){
+    if(sched_job[i].period == 0){continue;}
+    CRITICAL_GLOBAL(
+      now = (u16)tickcount;
+      stamp = global_ms;
+    );
+    if((s16)(now - sched_job[i].next) < 0){continue;}
+    sched_job[i].next += sched_job[i].period;
+    if((s16)(now - sched_job[i].next) >= 0){ // skip missed periods
+      sched_job[i].next = now + sched_job[i].period;
+    }
+
+    gpib_uniline(GPIB_UNI_CMD_START);
+    gpib_putchar(GPIB_CMD_UNL, 0);
+    gpib_putchar(GPIB_CMD_LAD(sched_job[i].item[0]), 0);
+    if(sched_job[i].item[1] != 0){
+      gpib_putchar(sched_job[i].item[1], 0);
+    }
+    gpib_putchar(GPIB_CMD_GET, 0);
+    gpib_uniline(GPIB_UNI_CMD_END);
+
+    print_u16(i);
+    print_space();
+    print_u32(stamp);
+    print_space();
+    read_tagged(sched_job[i].item);
+  }
+}
+#endif
+
 static __bit talkable_as_device;
 static __bit listening_as_device;
 static __bit serial_polling_as_device;
 
+/*
+ * Capture mode, in which the device keeps listening to all data bytes and
+ * ships them in full packets through a ring buffer.
+ * When the ring is full, NRFD is held (overrun), and its duration is monitored.
+ */
+static __xdata u8 capture_mode = 0;
+static __xdata u8 capture_head, capture_tail;
+static __xdata u16 capture_overruns;
+static __xdata u16 capture_hold_max; // [Timer3 count], 0xFFFF when longer than a Timer3 period
+static __bit capture_holding;
+static __bit capture_accepted;
+static __xdata timestamp_t capture_accepted_at;
+
+static void capture_init(){
+  capture_head = capture_tail = 0;
+  capture_overruns = 0;
+  capture_hold_max = 0;
+  capture_holding = FALSE;
+  capture_accepted = FALSE;
+}
+
+#ifndef GPIB_CONTROLLER_ONLY
+// @return TRUE when the bus is idle
+static u8 capture_polling(){
+  u8 loop = 0;
+  do{
+    u8 used = capture_head - capture_tail;
+    if(used >= CDC_DATA_EP_IN_PACKET_SIZE){
+      if(cdc_tx_packet(&capture_ring[capture_tail], CDC_DATA_EP_IN_PACKET_SIZE)){
+        capture_tail += CDC_DATA_EP_IN_PACKET_SIZE;
+        used -= CDC_DATA_EP_IN_PACKET_SIZE;
+      }
+    }
+
+    // transfer to routine to parse cdc_rx stream
+    if(cdc_rx_size() > 0){break;}
+
+    if(used == 0xFF){ // full, NRFD is kept asserted.
+      if(!capture_holding){
+        capture_holding = TRUE;
+        capture_overruns++;
+      }
+      continue;
+    }
+    capture_holding = FALSE;
+
+    if(capture_accepted){ // NRFD has been asserted since the last byte was accepted.
+      static __xdata timestamp_t now;
+      u32 ms;
+      u16 hold;
+      timestamp_latch(&now);
+      ms = now.ms - capture_accepted_at.ms;
+      hold = now.tick - capture_accepted_at.tick;
+      if(now.tick < capture_accepted_at.tick){ // borrow a period of Timer3
+        ms -= 10;
+        hold -= TIMER3_RELOAD;
+      }
+      if(ms > 0){hold = 0xFFFF;} // saturated
+      if(hold > capture_hold_max){capture_hold_max = hold;}
+    }
+
+    {
+      int res = gpib_getchar();
+      if(GPIB_GETCHAR_IS_ERROR(res)){ // idle, flush the rest.
+        capture_accepted = FALSE;
+        if(used > 0){
+          if(capture_head < capture_tail){
+            write_func((char *)&capture_ring[capture_tail], sizeof(capture_ring) - capture_tail);
+            capture_tail = 0;
+          }
+          write_func((char *)&capture_ring[capture_tail], capture_head - capture_tail);
+          capture_head = capture_tail = 0; // restart with packet aligned index
+        }
+        return TRUE;
+      }
+      timestamp_latch(&capture_accepted_at);
+      capture_accepted = TRUE;
+      if(GPIB_GETCHAR_IS_CMD(res)){continue;}
+      capture_ring[capture_head++] = GPIB_GETCHAR_TO_DATA(res);
+      sys_state |= SYS_GPIB_LISTENED;
+    }
+  }while(++loop); // return to main loop periodically
+  return FALSE;
+}
+#endif
+
+/*
+ * Sniff mode, in which the adapter passively observes the bus without any handshake.
+ * Records (see gpib_sniff()) share the capture ring, and are dropped when the ring is full.
+ */
+static __xdata u8 sniff_mode = 0;
+static __xdata u16 sniff_drops;
+
+#ifndef GPIB_CONTROLLER_ONLY
+static void sniff_flush(){
+  u8 used = capture_head - capture_tail;
+  if(used == 0){return;}
+  if(capture_head < capture_tail){
+    write_func((char *)&capture_ring[capture_tail], sizeof(capture_ring) - capture_tail);
+    capture_tail = 0;
+  }
+  write_func((char *)&capture_ring[capture_tail], capture_head - capture_tail);
+  capture_head = capture_tail = 0;
+}
+
+// @return TRUE when the bus is idle
+static u8 sniff_polling(){
+  u8 loop = 0;
+  do{
+    u8 used = capture_head - capture_tail;
+    if(used >= CDC_DATA_EP_IN_PACKET_SIZE){
+      if(cdc_tx_packet(&capture_ring[capture_tail], CDC_DATA_EP_IN_PACKET_SIZE)){
+        capture_tail += CDC_DATA_EP_IN_PACKET_SIZE;
+        used -= CDC_DATA_EP_IN_PACKET_SIZE;
+      }
+    }
+
+    // transfer to routine to parse cdc_rx stream
+    if(cdc_rx_size() > 0){break;}
+
+    if(used > (0xFF - GPIB_SNIFF_RECORD_SIZE)){ // full, the next record would make head reach tail.
+      static __xdata u8 dummy[GPIB_SNIFF_RECORD_SIZE];
+      if(!gpib_sniff(dummy)){return TRUE;}
+      sniff_drops++;
+      continue;
+    }
+    if(!gpib_sniff(&capture_ring[capture_head])){ // idle, flush the rest.
+      sniff_flush();
+      return TRUE;
+    }
+    capture_head += GPIB_SNIFF_RECORD_SIZE;
+  }while(++loop); // return to main loop periodically
+  return FALSE;
+}
+#endif
+
 static void device_init(){
   talkable_as_device = FALSE;
   listening_as_device = gpib_config.listen_only ? TRUE : FALSE;
@@ -239,11 +561,79 @@ static void device_init(){
   }
 }
 
+/*
+ * Command macros of ++macro, which are kept in the flash log (see config_store.h).
+ * The raw input between "++macro def <n>" and "++macro end" is recorded
+ * without being executed, and "++macro run <n>" replays it through parse()
+ * in gpib_polling() before the rest of cdc_rx stream.
+ */
+#define MACRO_NONE 0xFF
+static __xdata char macro_buf[CONFIG_STORE_PAYLOAD_MAX]; // being defined or replayed
+static __xdata u8 macro_recording = MACRO_NONE; // key of the macro being defined
+static __xdata u8 macro_size, macro_line_start;
+static __bit macro_dropped; // input of the current line exceeds macro_buf
+static __bit macro_overflow; // the definition is discarded
+static __xdata u8 macro_remain = 0; // bytes to be replayed
+static __xdata char * __xdata macro_c;
+static __bit macro_replaying;
+static __bit soft_reset; // ++rst soft requested
+
+static void macro_init(){
+  macro_recording = MACRO_NONE;
+  macro_remain = 0;
+}
+
+static void macro_record(char c){
+  if((macro_size == 0) && (c == '\n')){return;} // LF of CR LF ending "++macro def"
+  if(macro_size < sizeof(macro_buf)){
+    macro_buf[macro_size++] = c;
+  }else{
+    macro_dropped = TRUE;
+  }
+}
+
+// Takes the place of run_command() while recording, to find the end of each line
+static void macro_record_line(parsed_info_t *info){
+  if((info->cmd == CMD_MACRO) && (info->args > 0) && (info->arg[0] == ARG_END)){
+    if(!macro_overflow){
+      config_store_save(macro_recording, macro_buf, macro_line_start); // without "++macro end" line
+    }
+    macro_recording = MACRO_NONE;
+  }else if((info->cmd != CMD_TALK) || (info->args == 0)){ // end of line
+    if(macro_dropped){macro_overflow = TRUE;}
+    macro_line_start = macro_size;
+  }
+}
+
+static void macro_run(u8 key){
+  u8 size;
+  if(macro_replaying){return;} // not nested
+  config_store_flush(); // the macro may be being saved
+  size = config_store_size(key);
+  if((size == 0) || (!config_store_load(key, macro_buf, size))){return;}
+  macro_c = macro_buf;
+  macro_remain = size;
+}
+
+static void macro_replay(){
+  macro_replaying = TRUE;
+  while((macro_remain > 0) && (!soft_reset)){ // the rest is cleared by macro_init() of ++rst soft
+    macro_remain--;
+    parse(*(macro_c++));
+  }
+  macro_replaying = FALSE;
+}
+
 void run_command(parsed_info_t *info){
   u8 not_query = (!(gpib_config.debug & DEBUG_VERBOSE)) && (info->args > 0);
+  if(macro_recording != MACRO_NONE){
+    macro_record_line(info);
+    return;
+  }
+  if(info->cmd != CMD_TALK){tx_armed = FALSE;}
   switch(info->cmd){
     case CMD_ADDR: {
-      __xdata address_t *new_address = get_address(info);
+      __xdata address_t *new_address = get_address(info, 0);
       if(new_address){
         memcpy(&(gpib_config.address), new_address, sizeof(address_t));
       }
@@ -257,9 +647,9 @@ void run_command(parsed_info_t *info){
       print_1arg(CMD_AUTO, gpib_config.read_after_write); // return current auto
       break;
     case CMD_CLR:
-      if(gpib_config.is_controller){
+      if(gpib_is_controller()){
         force_end_talking();
-        gpib_cmd(GPIB_CMD_SDC, &gpib_config.address);
+        gpib_cmd(GPIB_CMD_SDC, &gpib_config.address, 0);
       }
       break;
     case CMD_EOI:
@@ -278,12 +668,12 @@ void run_command(parsed_info_t *info){
       print_1arg(CMD_EOT_ENABLE, gpib_config.eot); // return current eot
       break;
     case CMD_EOT_CHAR:
-      renew_arg0_u8(info, (__xdata char *)&gpib_config.eot_char, 255);
+      renew_arg0_u8(info, (__xdata u8 *)&gpib_config.eot_char, 255);
       if(not_query){break;}
       print_1arg(CMD_EOT_CHAR, (u8)gpib_config.eot_char); // return current eos_char
       break;
     case CMD_IFC:
-      if(gpib_config.is_controller){
+      if(gpib_is_controller()){
         force_end_talking();
         gpib_uniline(GPIB_UNI_BUS_CLEAR_START);
         wait_ms(1);
@@ -291,15 +681,15 @@ void run_command(parsed_info_t *info){
       }
       break;
     case CMD_LLO:
-      if(gpib_config.is_controller){
+      if(gpib_is_controller()){
         force_end_talking();
-        gpib_cmd(GPIB_CMD_LLO, NULL);
+        gpib_cmd(GPIB_CMD_LLO, NULL, 0);
       }
       break;
     case CMD_LOC:
-      if(gpib_config.is_controller){
+      if(gpib_is_controller()){
         force_end_talking();
-        gpib_cmd(GPIB_CMD_GTL, &gpib_config.address);
+        gpib_cmd(GPIB_CMD_GTL, &gpib_config.address, 0);
       }
       break;
     case CMD_LON:
@@ -308,29 +698,28 @@ void run_command(parsed_info_t *info){
       if(not_query){break;}
       print_1arg(CMD_LON, gpib_config.listen_only); // return current los
       break;
-    case CMD_MODE:
+    case CMD_MODE: {
+#ifndef GPIB_MODE_FIXED
+      u8 previous = gpib_config.is_controller;
       if(renew_arg0_u8(info, &gpib_config.is_controller, 1)){
         force_end_talking();
+        sniff_mode = 0;
+        capture_mode = 0;
+        capture_init();
+        if(previous != gpib_config.is_controller){sched_init();} // the mode arena changes its owner
         gpib_io_init();
-        if(!gpib_config.is_controller){device_init();}
+        if(!gpib_is_controller()){device_init();}
       }
+#endif
       if(not_query){break;}
       print_1arg(CMD_MODE, gpib_config.is_controller); // return current mode
       break;
+    }
     case CMD_READ: // Different from Prologix impl.
-      if(!gpib_config.is_controller){break;}
+      if(!gpib_is_controller()){break;}
       force_end_talking();
-      gpib_uniline(GPIB_UNI_CMD_START);
-      gpib_putchar(GPIB_CMD_UNL, 0);
-      gpib_putchar(GPIB_CMD_LAD(0), 0); // listener, it's me.
-      gpib_putchar(GPIB_CMD_TAD(gpib_config.address.item[0][0]), 0); // talker
-      gpib_uniline(GPIB_UNI_CMD_END);
-      if((info->args > 0) && (info->arg[0] == ARG_EOI)){
-        gpib_read(push_func, GPIB_READ_UNTIL_EOI);
-      }else{
-        gpib_read(push_func, 0);
-      }
-      sys_state |= SYS_GPIB_LISTENED;
+      gpib_read_from(gpib_config.address.item[0],
+          ((info->args > 0) && (info->arg[0] == ARG_EOI)) ? GPIB_READ_UNTIL_EOI : 0);
       break;
     case CMD_READ_TMO_MS:
       if(renew_arg0_u16(info, &gpib_config.timeout_ms, 3000)){
@@ -340,26 +729,110 @@ void run_command(parsed_info_t *info){
       print_1arg(CMD_READ_TMO_MS, gpib_config.timeout_ms);
       break;
     case CMD_RST:
+      config_store_flush(); // complete ++savecfg in progress
+      if((info->args > 0) && (info->arg[0] == ARG_SOFT)){
+        soft_reset = TRUE; // performed by gpib_polling(), outside of parse()
+        break;
+      }
       RSTSRC = 0x10; // RSTSRC.4(SWRSF) = 1 causes software reset
       break;
     case CMD_SAVECFG:
-      // Different from Prologic command, savecfg is performing one-shot save.
-      flash_update((flash_address_t)(void __code *)&gpib_config_saved,
-          (u8 *)&gpib_config, sizeof(gpib_config));
+      if((info->args > 0) && (info->arg[0] == ARG_STATUS)){ // 1 while saving, 0 after completion
+        print_1arg(CMD_SAVECFG, config_store_busy());
+        break;
+      }
+      // Different from Prologic command, savecfg is performing one-shot save,
+      // which is written to flash in background by config_store_polling().
+      config_store_save(CONFIG_STORE_KEY_BOOT, &gpib_config, sizeof(gpib_config));
       if(gpib_config.debug & DEBUG_VERBOSE){dump_config();}
       break;
+    case CMD_PROFILE: // ++profile save|load <n>, query returns whether each profile is saved.
+      if(info->args >= 2){
+        u8 key;
+        if((u16)info->arg[1] >= CONFIG_STORE_PROFILES){break;}
+        key = CONFIG_STORE_KEY_PROFILE(info->arg[1]);
+        if(info->arg[0] == ARG_SAVE){
+          config_store_save(key, &gpib_config, sizeof(gpib_config));
+        }else if(info->arg[0] == ARG_LOAD){
+          config_store_flush(); // the profile may be being saved
+          if(config_store_size(key) != sizeof(gpib_config)){break;} // not saved
+          // end the line being talked and the modes under the current configuration
+          force_end_talking();
+          sniff_mode = 0;
+          sched_init();
+          capture_mode = 0;
+          capture_init();
+          config_store_load(key, &gpib_config, sizeof(gpib_config));
+#ifdef GPIB_MODE_FIXED
+          gpib_config.is_controller = gpib_is_controller();
+#endif
+          // then apply the whole configuration at once, as ++mode does
+          gpib_io_init();
+          gpib_io_set_timeout();
+          if(!gpib_is_controller()){device_init();}
+          if(gpib_config.debug & DEBUG_VERBOSE){dump_config();}
+        }
+        break;
+      }
+      if(info->args > 0){break;}
+      {
+        u8 i;
+        if(gpib_config.debug & DEBUG_VERBOSE){
+          print_header();
+          write_func(command_str[CMD_PROFILE], strlen(command_str[CMD_PROFILE]));
+          print_space();
+        }
+        for(i = 0; i < CONFIG_STORE_PROFILES; ++i){
+          if(i > 0){print_space();}
+          print_u16(config_store_has(CONFIG_STORE_KEY_PROFILE(i)));
+        }
+        print_terminator(write_func);
+      }
+      break;
+    case CMD_MACRO: // ++macro def|run <n>, query returns the size of each macro.
+      if(info->args >= 2){
+        u8 key;
+        if((u16)info->arg[1] >= CONFIG_STORE_MACROS){break;}
+        key = CONFIG_STORE_KEY_MACRO(info->arg[1]);
+        if(info->arg[0] == ARG_DEF){
+          if(macro_replaying){break;}
+          macro_recording = key;
+          macro_size = macro_line_start = 0;
+          macro_dropped = macro_overflow = FALSE;
+        }else if(info->arg[0] == ARG_RUN){
+          macro_run(key);
+        }
+        break;
+      }
+      if(info->args > 0){break;}
+      {
+        u8 i;
+        if(gpib_config.debug & DEBUG_VERBOSE){
+          print_header();
+          write_func(command_str[CMD_MACRO], strlen(command_str[CMD_MACRO]));
+          print_space();
+        }
+        for(i = 0; i < CONFIG_STORE_MACROS; ++i){
+          if(i > 0){print_space();}
+          print_u16(config_store_size(CONFIG_STORE_KEY_MACRO(i)));
+        }
+        print_terminator(write_func);
+      }
+      break;
     case CMD_SPOLL: {
-      if(gpib_config.is_controller){
+      if(gpib_is_controller()){
         u8 buf[2];
         int stb;
 
         force_end_talking();
         gpib_uniline(GPIB_UNI_CMD_START);
+        gpib_putchar(GPIB_CMD_UNL, 0); // other listeners would accept the status byte before us
+        gpib_putchar(GPIB_CMD_LAD(0), 0); // listener, it's me.
         gpib_putchar(GPIB_CMD_SPE, 0);
         memcpy(buf, gpib_config.address.item[0], sizeof(gpib_config.address.item[0]));
         check_address(&(info->arg[0]), (u8)info->args, buf);
         buf[0] = GPIB_CMD_TAD(buf[0]);
-        gpib_write(buf, (buf[1] == 0 ? 1 : 2), 0);
+        gpib_write((char *)buf, (buf[1] == 0 ? 1 : 2), 0);
         gpib_uniline(GPIB_UNI_CMD_END);
 
         stb = gpib_getchar();
@@ -370,20 +843,20 @@ void run_command(parsed_info_t *info){
         buf[0] = GPIB_CMD_UNT;
         buf[1] = GPIB_CMD_SPD;
         gpib_uniline(GPIB_UNI_CMD_START);
-        gpib_write(buf, 2, 0);
+        gpib_write((char *)buf, 2, 0);
         gpib_uniline(GPIB_UNI_CMD_END);
       }
       break;
     }
     case CMD_SRQ: {
-      if(gpib_config.is_controller){
+      if(gpib_is_controller()){
         print_1arg(CMD_SRQ, gpib_uniline(GPIB_UNI_CHECK_SRQ_ASSERT));
       }
       break;
     }
     case CMD_STATUS:
       if(renew_arg0_u8(info, &gpib_config.status, 0xFF)){
-        if(!gpib_config.is_controller){
+        if(!gpib_is_controller()){
           gpib_uniline((gpib_config.status & 0x40)
               ? GPIB_UNI_SRQ_ASSERT : GPIB_UNI_SRQ_DEASSERT); // SRQ
         }
@@ -391,18 +864,40 @@ void run_command(parsed_info_t *info){
       if(not_query){break;}
       print_1arg(CMD_STATUS, gpib_config.status);
       break;
-    case CMD_TRG:
-      if(!gpib_config.is_controller){break;}
+    case CMD_TRG: { // ++trg [pad [sad]] ... [ts] [read]
+      __xdata address_t *targets = &gpib_config.address;
+      u8 i, options = 0, with_ts = FALSE, with_read = FALSE;
+      if(!gpib_is_controller()){break;}
       force_end_talking();
-      if(info->args == 0){
-        gpib_cmd(GPIB_CMD_GET, &gpib_config.address);
-      }else{
-        __xdata address_t *new_address = get_address(info);
-        if(new_address){
-          gpib_cmd(GPIB_CMD_GET, new_address);
+      for(i = 0; i < info->args; ++i){
+        switch(info->arg[i]){
+          case ARG_TS: with_ts = TRUE; options++; break;
+          case ARG_READ: with_read = TRUE; options++; break;
+        }
+      }
+      if(info->args > options){
+        targets = get_address(info, 0);
+        if(!targets){break;}
+      }
+      gpib_cmd(GPIB_CMD_GET, targets, with_ts ? GPIB_WRITE_TIMESTAMP : 0);
+      if(with_ts){ // time when GET has been accepted by all the devices
+        if(gpib_config.debug & DEBUG_VERBOSE){
+          print_header();
+          write_func(command_str[CMD_TRG], strlen(command_str[CMD_TRG]));
+          print_space();
+        }
+        print_hex32(timestamp_to_us(&gpib_write_timestamp));
+        print_terminator(write_func);
+      }
+      if(with_read){ // read each triggered device, whose reply is prefixed with its address.
+        for(i = 0; i < targets->valid_items; ++i){
+          print_u16(targets->item[i][0]);
+          print_space();
+          read_tagged(targets->item[i]);
         }
       }
       break;
+    }
 #define print_str(str) write_func(str, sizeof(str) - 1)
     case CMD_VER:
       if(gpib_config.debug & DEBUG_VERBOSE){
@@ -436,7 +931,7 @@ void run_command(parsed_info_t *info){
     case CMD_TALK: {
       static __xdata char buf;
       if(talking){
-        if(gpib_config.debug & DEBUG_GPIB_ECHO){
+        if(debug_echo(DEBUG_GPIB_ECHO)){
           push_func(buf); // print character to be tried to write
         }
         if(info->args == 0){ // terminator
@@ -447,7 +942,9 @@ void run_command(parsed_info_t *info){
             print_terminator(gpib_write_auto_eoi);
           }
           talking = FALSE;
-          if(gpib_config.read_after_write){
+          if(tx_armed){
+            tx_read();
+          }else if(gpib_config.read_after_write){
             info->cmd = CMD_READ;
             // info->args = 0;
             run_command(info); // valid only for controller.
@@ -458,47 +955,246 @@ void run_command(parsed_info_t *info){
         }
         sys_state |= SYS_GPIB_TALKED;
       }else if(info->args > 0){ // ignore terminator when not talking.
-        if(gpib_config.is_controller){ // controller
-          gpib_cmd(GPIB_CMD_TAD(0), &gpib_config.address); // talker, it's me.
+        if(gpib_is_controller()){ // controller
+          gpib_cmd(GPIB_CMD_TAD(0),
+              tx_armed ? tx_target : &gpib_config.address, 0); // talker, it's me.
           talking = TRUE;
         }else if(talkable_as_device){ // device
           talking = TRUE;
         }
         buf = (u8)(info->arg[0]);
+      }else if(tx_armed){ // empty line after ++tx, read only transaction
+        tx_read();
       }
       break;
     }
+    case CMD_TX: { // ++tx tag pad [sad] ..., then the next line is written and read back with the tag.
+      __xdata address_t *target;
+      if((!gpib_is_controller()) || (info->args < 2)
+          || (info->arg[0] == ARG_ERR)){break;} // tag up to 0xFFFE
+      force_end_talking();
+      tx_tag = (u16)info->arg[0];
+      target = get_address(info, 1);
+      if(target){
+        tx_target = target;
+        tx_armed = TRUE;
+      }
+      break;
+    }
+#ifndef GPIB_DEVICE_ONLY
+    case CMD_SCHED: // ++sched [n period_ms [pad [sad]]], period_ms = 0 cancels the job.
+      if(!gpib_is_controller()){break;}
+      if((info->args >= 2) && ((u16)info->arg[0] < SCHED_JOBS)){
+        u8 i = (u8)info->arg[0];
+        u16 ms = (u16)info->arg[1], period = 0; // in u16, whose range exceeds 16-bit int
+        if(info->arg[1] != ARG_ERR){period = ms / 10 + ((ms % 10) != 0);}
+        sched_job[i].period = 0;
+        if((period > 0) && check_address(&(info->arg[2]), (u8)(info->args - 2), sched_job[i].item)){
+          CRITICAL_GLOBAL(sched_job[i].next = (u16)tickcount);
+          sched_job[i].period = period;
+        }
+      }
+      if(not_query){break;}
+      sched_dump();
+      break;
+#endif
+    case CMD_TSTAMP: // ++tstamp [0|1], query returns mode and the timestamps of the last message.
+      renew_arg0_u8(info, &tstamp_mode, 1);
+      if(not_query){break;}
+      if(gpib_config.debug & DEBUG_VERBOSE){
+        print_header();
+        write_func(command_str[CMD_TSTAMP], strlen(command_str[CMD_TSTAMP]));
+        print_space();
+      }
+      print_u16(tstamp_mode);
+      print_space();
+      print_hex32(timestamp_to_us(&gpib_read_timestamp[0]));
+      print_space();
+      print_hex32(timestamp_to_us(&gpib_read_timestamp[1]));
+      print_terminator(write_func);
+      break;
+#ifndef GPIB_CONTROLLER_ONLY
+    case CMD_CAPTURE: // ++capture [0|1], query returns mode, overruns and the longest NRFD holding time [us].
+      if(gpib_is_controller()){break;}
+      if(renew_arg0_u8(info, &capture_mode, 1)){
+        capture_init();
+      }
+      if(not_query){break;}
+      if(gpib_config.debug & DEBUG_VERBOSE){
+        print_header();
+        write_func(command_str[CMD_CAPTURE], strlen(command_str[CMD_CAPTURE]));
+        print_space();
+      }
+      print_u16(capture_mode);
+      print_space();
+      print_u16(capture_overruns);
+      print_space();
+      print_u16((capture_hold_max == 0xFFFF) // saturated
+          ? 0xFFFF : (capture_hold_max / (u16)(TIMER3_CLK / 1000000UL)));
+      print_terminator(write_func);
+      break;
+    case CMD_SNIFF: // ++sniff [0|1], query returns mode and the number of dropped records.
+      if(gpib_is_controller()){break;}
+      {
+        u8 previous = sniff_mode;
+        if(renew_arg0_u8(info, &sniff_mode, 1) && (previous != sniff_mode)){
+          capture_mode = 0; // the ring is shared
+          capture_init();
+          sniff_drops = 0;
+          if(sniff_mode){
+            gpib_io_sniff_init();
+          }else{
+            gpib_io_init();
+            device_init();
+          }
+        }
+      }
+      if(not_query){break;}
+      if(gpib_config.debug & DEBUG_VERBOSE){
+        print_header();
+        write_func(command_str[CMD_SNIFF], strlen(command_str[CMD_SNIFF]));
+        print_space();
+      }
+      print_u16(sniff_mode);
+      print_space();
+      print_u16(sniff_drops);
+      print_terminator(write_func);
+      break;
+#endif
+    case CMD_STATS: // ++stats [reset]
+      if((info->args > 0) && (info->arg[0] == ARG_RESET)){
+        stats_reset();
+        break;
+      }
+      if(gpib_config.debug & DEBUG_VERBOSE){
+        print_header();
+        write_func(command_str[CMD_STATS], strlen(command_str[CMD_STATS]));
+        print_space();
+      }
+      print_u32(stats.bytes_written);
+      print_space();
+      print_u32(stats.bytes_read);
+      print_space();
+      print_u16(stats.timeout_nrfd);
+      print_space();
+      print_u16(stats.timeout_ndac);
+      print_space();
+      print_u16(stats.timeout_dav);
+      print_space();
+      print_u16(stats.tx_retries);
+      print_space();
+      print_u16(stats.tx_drops);
+      print_space();
+      print_u16(stats.rx_backlogs);
+      print_space();
+      print_u16(stats.loops_per_sec);
+      print_space();
+      print_u32(stats.read_max_ms * 1000
+          + stats.read_max_count / (u16)(TIMER3_CLK / 1000000UL));
+      print_space();
+      print_u32(stats_boot_us);
+      print_terminator(write_func);
+      break;
+#ifdef GPIB_IO_HISTOGRAM
+    case CMD_HIST: { // ++hist [reset], query returns a line of bins for each of NRFD, NDAC, DAV and byte.
+      u8 i, j;
+      if((info->args > 0) && (info->arg[0] == ARG_RESET)){
+        gpib_io_hist_reset();
+        break;
+      }
+      for(i = 0; i < GPIB_IO_HISTS; ++i){
+        if(gpib_config.debug & DEBUG_VERBOSE){
+          print_header();
+          write_func(command_str[CMD_HIST], strlen(command_str[CMD_HIST]));
+          print_space();
+        }
+        print_u16(i);
+        for(j = 0; j < GPIB_IO_HIST_BINS; ++j){
+          print_space();
+          print_u16(gpib_io_hist[i][j]);
+        }
+        print_terminator(write_func);
+      }
+      break;
+    }
+#endif
   }
 }
 
 void gpib_init(){
-  memcpy(&gpib_config, &gpib_config_saved, sizeof(gpib_config));
+  config_store_init();
+  if(!config_store_load(CONFIG_STORE_KEY_BOOT, &gpib_config, sizeof(gpib_config))){
+    memcpy(&gpib_config, &gpib_config_default, sizeof(gpib_config));
+  }
+#ifdef GPIB_MODE_FIXED
+  gpib_config.is_controller = gpib_is_controller(); // by the build variant, even if saved otherwise
+#endif
   gpib_io_init();
   gpib_io_set_timeout();
   parser_reset();
 
   talking = FALSE;
+  tx_armed = FALSE;
+  tstamp_mode = 0;
+  tstamp_pending = FALSE;
+  sched_init();
+  capture_mode = 0;
+  capture_init();
+  sniff_mode = 0;
+  sniff_drops = 0;
   device_init();
+  macro_init();
 }
 
 void gpib_polling(){
-  static __xdata char buf[16];
+  static __xdata char buf[XRAM_RX_CHUNK];
   static __xdata u8 remain = 0;
   static __xdata char * __xdata c;
+  __bit rx_idle;
 
   sys_state &= ~(SYS_GPIB_TALKED | SYS_GPIB_LISTENED);
 
-  // parse cdc_rx stream
-  if(remain == 0){
-    remain = (u8)cdc_rx(buf, sizeof(buf));
-    c = buf;
+  if(macro_remain > 0){ // ++macro run, replayed prior to the rest of cdc_rx stream
+    macro_replay();
+    rx_idle = FALSE;
+  }else{
+    // parse cdc_rx stream
+    if(remain == 0){
+      remain = (u8)cdc_rx((u8 *)buf, sizeof(buf));
+      c = buf;
+    }
+    rx_idle = (remain == 0); // no input; a good time for background jobs
+    for(; remain > 0; remain--, c++){
+      if((macro_remain > 0) || soft_reset){break;}
+      if(debug_echo(DEBUG_ECHO)){push_func(*c);}
+      if(macro_recording != MACRO_NONE){macro_record(*c);}
+      parse(*c);
+    }
   }
-  for(; remain > 0; remain--, c++){
-    if(gpib_config.debug & DEBUG_ECHO){push_func(*c);}
-    parse(*c);
+
+  if(soft_reset){
+    // Warm reset, which reloads the saved config and reinitializes the GPIB side only,
+    // while USB stays enumerated. The input loop has stopped at the end of the line
+    // of ++rst soft, so the rest is parsed from a line head by the reinitialized parser.
+    soft_reset = FALSE;
+    gpib_init();
   }
 
-  if((!gpib_config.is_controller) && (!talking)){ // device mode
+  if(gpib_is_controller()){
+    if((!talking) && (!tx_armed)){
+#ifndef GPIB_DEVICE_ONLY
+      sched_polling();
+#endif
+      if(rx_idle){config_store_polling();} // between transfers
+    }
+  }
+#ifndef GPIB_CONTROLLER_ONLY
+  else if(sniff_mode){
+    if(sniff_polling() && rx_idle){config_store_polling();} // while the bus is idle as well
+  }else if(capture_mode){
+    if(capture_polling() && rx_idle){config_store_polling();}
+  }else if(!talking){ // device mode
+    if(rx_idle){config_store_polling();} // before waiting for the controller
     do{
       static __bit last_char_is_cr = FALSE;
       int res = gpib_getchar();
@@ -571,10 +1267,11 @@ void gpib_polling(){
       }
     }while(1);
   }
+#endif
 
   write_func(NULL, 0); // flush buffer
 
-  if(gpib_config.is_controller){
+  if(gpib_is_controller()){
     sys_state |= SYS_GPIB_CONTROLLER;
   }else{
     sys_state &= ~SYS_GPIB_CONTROLLER;
@@ -60,4 +60,20 @@ typedef __xdata gpib_config_struct gpib_config_t;
 
 extern gpib_config_t gpib_config;
 
+/*
+ * Build variants; GPIB_CONTROLLER_ONLY or GPIB_DEVICE_ONLY fixes the mode,
+ * so that the branches on it are resolved at compile time.
+ */
+#if defined(GPIB_CONTROLLER_ONLY) && defined(GPIB_DEVICE_ONLY)
+#error "GPIB_CONTROLLER_ONLY and GPIB_DEVICE_ONLY are exclusive"
+#elif defined(GPIB_CONTROLLER_ONLY)
+#define gpib_is_controller() TRUE
+#define GPIB_MODE_FIXED
+#elif defined(GPIB_DEVICE_ONLY)
+#define gpib_is_controller() FALSE
+#define GPIB_MODE_FIXED
+#else
+#define gpib_is_controller() (gpib_config.is_controller)
+#endif
+
 #endif /* __GPIB_H__ */
@@ -33,6 +33,9 @@
 #include "c8051f380.h"
 #include "main.h"
 #include "gpib.h"
+#include "stats.h"
+
+#include <string.h>
 
 #define TE 0x10
 #define SC 0x20
@@ -60,6 +63,38 @@
 #define p2_low(port)   (P2 &= ~(port))
 #endif
 
+#ifdef GPIB_IO_HISTOGRAM
+__xdata u16 gpib_io_hist[GPIB_IO_HISTS][GPIB_IO_HIST_BINS];
+
+void gpib_io_hist_reset(){
+  memset(gpib_io_hist, 0, sizeof(gpib_io_hist));
+}
+
+static void hist_add(u8 kind, u16 duration){
+  u8 bin = 0;
+  if(duration >= 0x100){
+    bin = 8;
+    duration >>= 8;
+  }
+  for(; duration > 0; duration >>= 1){bin++;}
+  if(bin >= GPIB_IO_HIST_BINS){bin = GPIB_IO_HIST_BINS - 1;}
+  if(gpib_io_hist[kind][bin] < 0xFFFF){gpib_io_hist[kind][bin]++;}
+}
+#define hist_latch(t) ((t) = PCA0)
+#define hist_since(kind, t) hist_add(kind, PCA0 - (t))
+#else
+#define hist_latch(t)
+#define hist_since(kind, t)
+#endif
+
+#ifdef GPIB_IO_BENCH
+// Emulates the other devices on the bus, see bench/bench.c
+void gpib_io_bench_poll();
+#define bench_poll() gpib_io_bench_poll()
+#else
+#define bench_poll()
+#endif
+
 static __bit is_talker;
 
 static void set_talker(){
@@ -87,7 +122,7 @@ void gpib_io_init(){
   set_listener();
 
   p2_hiz(ATN | IFC | SRQ | REN);
-  if(gpib_config.is_controller){
+  if(gpib_is_controller()){
     p2_low(REN);
     p0_low(DC); // T[ATN], R[SRQ]
     p0_hiz(SC); // T[REN,IFC]
@@ -97,6 +132,16 @@ void gpib_io_init(){
   }
 }
 
+// Releases all the lines in order not to participate in any handshake.
+void gpib_io_sniff_init(){
+  is_talker = TRUE; // set_listener() is required to participate again.
+  P1 = 0xFF; /* Float all data lines */
+  p2_hiz(EOI | DAV | NRFD | NDAC | ATN | IFC | SRQ | REN);
+  p0_low(TE | PE); /* R[Data,DAV] */
+  p0_hiz(DC); // R[ATN]
+  p0_low(SC); // R[REN,IFC]
+}
+
 static __xdata u8 timeout_10ms_max;
 
 void gpib_io_set_timeout(){
@@ -124,13 +169,53 @@ u8 gpib_uniline(enum uniline_message_t msg){
 static u8 wait_p2(u8 state, u8 mask){
   timeout_10ms = 0;
   do{
+    bench_poll();
     if((P2 & mask) == state){return 0;}
   }while(timeout_10ms_max >= timeout_10ms);
   return 1; // timeout
 }
 
+__xdata timestamp_t gpib_write_timestamp;
+
+/**
+ * Observe a byte on the bus without handshake, which requires gpib_io_sniff_init() in advance.
+ *
+ * @param record destination, whose size is GPIB_SNIFF_RECORD_SIZE
+ * @return 1 when a byte is observed, 0 when timeout
+ */
+u8 gpib_sniff(__xdata u8 *record){
+  static __xdata timestamp_t last, now; // last.ms = 0 makes the first delta over
+  u32 ms;
+  u16 delta;
+
+  // Wait for DAV to go low
+  if(wait_p2(0, DAV)){return 0;}
+  record[0] = (P2 ^ 0xFF) & (ATN | EOI | IFC | REN);
+  record[1] = (P1 ^ 0xFF);
+  timestamp_latch(&now); // Timer3 and its tick, consistent with each other
+
+  ms = now.ms - last.ms;
+  delta = now.tick - last.tick;
+  if(now.tick < last.tick){ // borrow a period of Timer3
+    ms -= 10;
+    delta -= TIMER3_RELOAD;
+  }
+  if(ms > 0){delta = GPIB_SNIFF_DELTA_OVER;}
+  record[2] = (u8)delta;
+  record[3] = (u8)(delta >> 8);
+  memcpy(&last, &now, sizeof(timestamp_t));
+
+  // Wait for DAV to go high, the end of the handshake by the others
+  wait_p2(DAV, DAV);
+  return 1;
+}
+
 static u8 putchar_internal(u8 c, u8 flags){
+#ifdef GPIB_IO_HISTOGRAM
+  u16 t_start, t_dav;
+#endif
 
+  hist_latch(t_start);
   P1 = (c ^ 0xFF); // Put the byte on the data lines
   if(flags & GPIB_WRITE_USE_EOI){
     p2_low(EOI); // Assert EOI
@@ -138,17 +223,28 @@ static u8 putchar_internal(u8 c, u8 flags){
 
   // Make sure that NRFD is high
   if(wait_p2(NRFD, NRFD)){
+    stats.timeout_nrfd++;
     gpib_io_init();
     return 0;
   }
+  hist_since(GPIB_IO_HIST_NRFD, t_start);
+  hist_latch(t_dav);
   p2_low(DAV); // Inform listeners that the data is ready to be read
 
   // Wait for NDAC to go high, all listeners have accepted the byte
   if(wait_p2(NDAC, NDAC)){
+    stats.timeout_ndac++;
     gpib_io_init();
     return 0;
   }
   p2_hiz(DAV | EOI); // Byte has been accepted by all, indicate byte is no longer valid
+  hist_since(GPIB_IO_HIST_NDAC, t_dav);
+  hist_since(GPIB_IO_HIST_BYTE, t_start);
+  stats.bytes_written++;
+
+  if(flags & GPIB_WRITE_TIMESTAMP){
+    timestamp_latch(&gpib_write_timestamp);
+  }
 
   return 1;
 }
@@ -161,7 +257,7 @@ u8 gpib_putchar(char c, u8 flags){
   return 1;
 }
 
-u16 gpib_write(char *buf, u16 length, u8 flags){
+u16 gpib_write(const char *buf, u16 length, u8 flags){
   u16 remain = length;
   u8 flags_without_eoi = flags & ~(GPIB_WRITE_USE_EOI);
 
@@ -179,16 +275,21 @@ u16 gpib_write(char *buf, u16 length, u8 flags){
 
 static int getchar_internal(){
   int res;
+#ifdef GPIB_IO_HISTOGRAM
+  u16 t_start;
+#endif
   
   // Assuming both NDAC and NRFD are LOW.
 
   // Raise NRFD, telling the talker we are ready for the next byte
+  hist_latch(t_start);
   p2_hiz(NRFD);
   // Wait for DAV to go low (talker informing us the byte is ready)
   if(wait_p2(0, DAV)){
     gpib_io_init();
-    return -1; // timeout
+    return -1; // timeout, which may be idle
   }
+  hist_since(GPIB_IO_HIST_DAV, t_start);
   // Assert NRFD, informing talker to not change the data lines
   p2_low(NRFD);
 
@@ -201,11 +302,14 @@ static int getchar_internal(){
   p2_hiz(NDAC);
   // Wait for DAV to go high (talker knows that we have read the byte)
   if(wait_p2(DAV, DAV)){
+    stats.timeout_dav++;
     gpib_io_init();
-    return -1; // timeout
+    return -2; // timeout in handshake
   }
   // Low NDAC to prepare for next byte
   p2_low(NDAC);
+  hist_since(GPIB_IO_HIST_BYTE, t_start);
+  stats.bytes_read++;
 
   return res;
 }
@@ -215,7 +319,10 @@ int gpib_getchar(){
   return getchar_internal();
 }
 
+__xdata timestamp_t gpib_read_timestamp[2];
+
 u16 gpib_read(void (*push)(char), u8 flags){
+  static __xdata timestamp_t start, end;
   u16 read_count = 0;
   int res;
   char c;
@@ -225,10 +332,14 @@ u16 gpib_read(void (*push)(char), u8 flags){
   u8 terminator
       = (flags & GPIB_READ_UNTIL_EOI) ? 3 : gpib_config.eos;
 
+  timestamp_latch(&start);
   set_listener();
   while(1){
     res = getchar_internal();
     if(GPIB_GETCHAR_IS_ERROR(res)){break;}
+    if((read_count == 0) && (flags & GPIB_READ_TIMESTAMP)){ // the first DAV only
+      timestamp_latch(&gpib_read_timestamp[0]);
+    }
     read_count++;
     c = GPIB_GETCHAR_TO_DATA(res);
     push(c);
@@ -249,6 +360,25 @@ u16 gpib_read(void (*push)(char), u8 flags){
       last_char_is_cr = FALSE;
     }
   }
+  if(res == -1){stats.timeout_dav++;} // talker has not responded.
+
+  timestamp_latch(&end);
+  if((read_count > 0) && (flags & GPIB_READ_TIMESTAMP)){ // EOI, terminator or timeout
+    memcpy(&gpib_read_timestamp[1], &end, sizeof(timestamp_t));
+  }
+  {
+    u32 ms = end.ms - start.ms;
+    u16 count = end.tick - start.tick;
+    if(end.tick < start.tick){ // borrow a period of Timer3
+      ms -= 10;
+      count -= TIMER3_RELOAD;
+    }
+    if((ms > stats.read_max_ms)
+        || ((ms == stats.read_max_ms) && (count > stats.read_max_count))){
+      stats.read_max_ms = ms;
+      stats.read_max_count = count;
+    }
+  }
 
   return read_count;
 }
@@ -33,14 +33,16 @@
 #define __GPIB_IO_H__
 
 #include "type.h"
+#include "main.h"
 
 void gpib_io_init();
 void gpib_io_set_timeout();
 
 #define GPIB_WRITE_USE_EOI 0x01
+#define GPIB_WRITE_TIMESTAMP 0x02
 
 u8 gpib_putchar(char c, u8 flags);
-u16 gpib_write(char *buf, u16 length, u8 flags);
+u16 gpib_write(const char *buf, u16 length, u8 flags);
 
 #define GPIB_GETCHAR_IS_ERROR(x) (x < 0)
 #define GPIB_GETCHAR_IS_EOI(x) (x >= 0x100)
@@ -50,9 +52,52 @@ u16 gpib_write(char *buf, u16 length, u8 flags);
 int gpib_getchar();
 
 #define GPIB_READ_UNTIL_EOI 0x01
+#define GPIB_READ_TIMESTAMP 0x02
+
+// Latched by gpib_putchar()/gpib_write() with GPIB_WRITE_TIMESTAMP when the last byte is accepted (NDAC released)
+extern __xdata timestamp_t gpib_write_timestamp;
+
+// Latched by gpib_read() with GPIB_READ_TIMESTAMP when the first and the last bytes are accepted
+extern __xdata timestamp_t gpib_read_timestamp[2];
 
 u16 gpib_read(void (*push)(char), u8 flags);
 
+#ifdef GPIB_IO_HISTOGRAM
+/*
+ * Handshake latency histograms, measured with PCA0 counter (SYSCLK/4, 83.3 ns).
+ * Bin i counts durations whose bit length is i, i.e., [2^(i-1), 2^i) counts.
+ * Durations of 5.46 ms or more are folded because the counter is 16 bits.
+ */
+enum gpib_io_hist_t {
+  GPIB_IO_HIST_NRFD, // talker, waiting for NRFD high
+  GPIB_IO_HIST_NDAC, // talker, from DAV low to NDAC high
+  GPIB_IO_HIST_DAV, // listener, from NRFD high to DAV low
+  GPIB_IO_HIST_BYTE, // talker and listener, whole handshake of a byte
+  GPIB_IO_HISTS,
+};
+#define GPIB_IO_HIST_BINS 16
+#define GPIB_IO_HIST_CLK (SYSCLK/4)
+
+extern __xdata u16 gpib_io_hist[GPIB_IO_HISTS][GPIB_IO_HIST_BINS];
+void gpib_io_hist_reset();
+#endif
+
+/*
+ * Passive observation (sniffer) without handshake.
+ * Each byte is recorded as 4 bytes; flags, data, and the elapsed time from the previous byte.
+ * The flags are asserted lines in positive logic (SRQ is not observable), and the time is in Timer3 count (0.25 us),
+ * which is saturated to GPIB_SNIFF_DELTA_OVER (10 ms or more).
+ */
+#define GPIB_SNIFF_ATN 0x02
+#define GPIB_SNIFF_EOI 0x04
+#define GPIB_SNIFF_IFC 0x40
+#define GPIB_SNIFF_REN 0x80
+#define GPIB_SNIFF_RECORD_SIZE 4
+#define GPIB_SNIFF_DELTA_OVER 0xFFFF
+
+void gpib_io_sniff_init();
+u8 gpib_sniff(__xdata u8 *record);
+
 enum uniline_message_t {
   GPIB_UNI_CMD_START,
   GPIB_UNI_CMD_END,
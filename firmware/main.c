@@ -38,6 +38,7 @@
 #include "c8051f380.h"
 #include "f38x_usb.h"
 #include "gpib.h"
+#include "stats.h"
 
 volatile __xdata u32 global_ms = 0;
 volatile __xdata u32 tickcount = 0;
@@ -59,21 +60,21 @@ void timer_init();
 #endif
 
 void main() {
+  port_init(); // Initialize crossbar and GPIO, which releases the GPIB lines first
   sysclk_init(); // Initialize oscillator
-  wait_ms(1000);
-  port_init(); // Initialize crossbar and GPIO
+  timer_init();
 
-  gpib_init();
+  usb0_init(); // Attach as early as possible; the host enumerates while the rest is initialized
 
-  timer_init();
-  
   EA = 1; // Global Interrupt enable
 
-  usb0_init();
+  gpib_init();
+  stats_reset();
 
   while (1) {
     gpib_polling();
     usb_polling();
+    stats_loop();
 
     if(sys_state & SYS_PERIODIC_ACTIVE){
       sys_state &= ~SYS_PERIODIC_ACTIVE;
@@ -133,6 +134,7 @@ void sysclk_init(){
   
   // Configure internal oscillator for its maximum frequency and enable missing clock detector
   OSCICN |= 0x03;
+  while(!(OSCICN & 0x40)); // Wait for internal oscillator to be ready (IFRDY)
 
 #ifdef _USB_LOW_SPEED_
   CLKSEL  = SYS_INT_OSC; // Select System clock
@@ -141,10 +143,9 @@ void sysclk_init(){
   // Select internal oscillator as input to clock multiplier
   CLKMUL  = 0x00;
   CLKMUL |= 0x80; // Enable clock multiplier
-  wait_ms(1); // Delay for clock multiplier to begin
+  wait_us(5); // Delay for clock multiplier to begin, 5 us at least
   CLKMUL |= 0xC0; // Initialize the clock multiplier
-  wait_ms(1);
-  while(!(CLKMUL & 0x20)); // Wait for multiplier to lock
+  while(!(CLKMUL & 0x20)); // Wait for multiplier to lock (MULRDY)
   CLKSEL = SYS_4X_MUL;
   CLKSEL |= USB_4X_CLOCK; // Select USB clock
 #endif  /* _USB_LOW_SPEED_ */
@@ -188,10 +189,16 @@ void port_init() {
 void timer_init(){
   TMR3CN = 0x00;    // Stop Timer3; Clear TF3;
   CKCON &= ~0xC0;   // Timer3 clocked based on T3XCLK;
-  TMR3RL = (0x10000 - (SYSCLK/12/100));  // Re-initialize reload value (100Hz, 10ms)
+  TMR3RL = TIMER3_RELOAD;  // Re-initialize reload value (100Hz, 10ms)
   TMR3 = 0xFFFF;    // Set to reload immediately
   EIE1 |= 0x80;     // Enable Timer3 interrupts(ET3)
   TMR3CN |= 0x04;   // Start Timer3(TR3)
+
+#ifdef GPIB_IO_HISTOGRAM
+  // PCA0 as a free-running counter for handshake latency
+  PCA0MD = (PCA0MD & ~0x0E) | 0x02; // SYSCLK/4
+  PCA0CN |= 0x40;   // Start PCA0(CR)
+#endif
 }
 
 /**
@@ -206,6 +213,31 @@ void interrupt_timer3() __interrupt (INTERRUPT_TIMER3) {
   sys_state |= SYS_PERIODIC_ACTIVE;
 }
 
+void timestamp_latch(__xdata timestamp_t *ts){
+  __bit ea_orig = EA;
+  u8 h, l;
+  EA = 0;
+  do{
+    h = TMR3H;
+    l = TMR3L;
+  }while(h != TMR3H);
+  ts->ms = global_ms;
+  if(TMR3CN & 0x80){ // overflow is not serviced yet
+    do{
+      h = TMR3H;
+      l = TMR3L;
+    }while(h != TMR3H);
+    ts->ms += 10;
+  }
+  EA = ea_orig;
+  ts->tick = ((u16)h << 8) | l;
+}
+
+u32 timestamp_to_us(__xdata timestamp_t *ts){
+  return (ts->ms * 1000)
+      + ((u16)(ts->tick - TIMER3_RELOAD) / (u16)(TIMER3_CLK / 1000000UL));
+}
+
 unsigned char _sdcc_external_startup(){
   PCA0MD &= ~0x40; ///< Disable Watchdog timer
   return 0;
@@ -50,6 +50,22 @@ extern volatile __xdata u8 sys_state;
 
 extern volatile u8 timeout_10ms;
 
+// Timer3 generates the 10 ms tick, whose count is available as a sub-tick time.
+#define TIMER3_CLK (SYSCLK/12)
+#define TIMER3_RELOAD (0x10000 - (TIMER3_CLK/100))
+
+/*
+ * Device time, which consists of global_ms and the Timer3 count.
+ * Latching is cheap, and conversion to microseconds is deferred.
+ */
+typedef struct {
+  u32 ms;
+  u16 tick;
+} timestamp_t;
+
+void timestamp_latch(__xdata timestamp_t *ts);
+u32 timestamp_to_us(__xdata timestamp_t *ts);
+
 // Define Endpoint Packet Sizes
 #ifdef _USB_LOW_SPEED_
 // This value can be 8,16,32,64 depending on device speed, see USB spec
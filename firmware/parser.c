@@ -30,6 +30,8 @@
  */
 
 #include "parser.h"
+#include "xram.h"
+#include "command_hash.h"
 
 #include <string.h>
 
@@ -65,8 +67,20 @@ const __code char * __code command_str[] = {
   "ver",
   "help",
   "debug",
+  "tx",
+  "sched",
+  "tstamp",
+  "capture",
+  "sniff",
+  "stats",
+  "hist",
+  "profile",
+  "macro",
 };
 
+// command_hash.h is generated from command_str[] by gen_command_hash.sh; fails to compile when stale
+typedef char command_hash_is_stale[(COMMAND_HASH_COMMANDS == CMD_INPUTABLE) ? 1 : -1];
+
 static enum command_t check_cmd(__xdata char *str, u8 len){
 #if LOCAL_TEST
   {
@@ -78,75 +92,50 @@ static enum command_t check_cmd(__xdata char *str, u8 len){
     printf("\n");
   }
 #endif
-#define check_str(cmd) { \
-  if(memcmp(command_str[cmd], str, len) == 0){ \
-    return cmd; \
-  } \
-}
-  switch(len){
-    case 3:
-      check_str(CMD_CLR);
-      check_str(CMD_EOI);
-      check_str(CMD_EOS);
-      check_str(CMD_IFC);
-      check_str(CMD_LLO);
-      check_str(CMD_LOC);
-      check_str(CMD_LON);
-      check_str(CMD_RST);
-      check_str(CMD_SRQ);
-      check_str(CMD_TRG);
-      check_str(CMD_VER);
-      break;
-    case 4:
-      check_str(CMD_ADDR);
-      check_str(CMD_AUTO);
-      check_str(CMD_MODE);
-      check_str(CMD_READ);
-      check_str(CMD_HELP);
-      break;
-    case 5:
-      check_str(CMD_SPOLL);
-      check_str(CMD_DEBUG);
-      break;
-    case 6:
-      check_str(CMD_STATUS);
-      break;
-    case 7:
-      check_str(CMD_SAVECFG);
-      break;
-    case 8:
-      check_str(CMD_EOT_CHAR);
-      break;
-    case 10:
-      check_str(CMD_EOT_ENABLE);
-      break;
-    case 11:
-      check_str(CMD_READ_TMO_MS);
-      break;
+  if(len >= 2){
+    u8 cmd = command_hash_table[command_hash(str, len)];
+    if((cmd < CMD_INPUTABLE)
+        && (memcmp(command_str[cmd], str, len) == 0)
+        && (command_str[cmd][len] == '\0')){
+      return (enum command_t)cmd;
+    }
   }
-#undef check_str
   return CMD_ERROR;
 }
 
-static int check_arg(__xdata char *str, u8 len){
-  int res;
-#if defined(__SDCC) || defined(SDCC) || LOCAL_TEST
-  int i;
-  for(res = 0, i = 0; i < len; ++i){
-    int v = str[i] - '0';
-    if((v < 0) || (v > 9)){return ARG_ERR;}
-    res *= 10;
-    res += v;
+/*
+ * Decimal, 0x-prefixed hexadecimal or 0b-prefixed binary number up to 0xFFFE,
+ * otherwise ARG_ERR, which 0xFFFF is as 16-bit int.
+ */
+static s16 check_arg(__xdata char *str, u8 len){
+  u16 res = 0;
+  u8 shift = 0, i = 0;
+  if((len > 2) && (str[0] == '0')){
+    switch(str[1]){
+      case 'x': case 'X': shift = 4; i = 2; break;
+      case 'b': case 'B': shift = 1; i = 2; break;
+    }
   }
-#else
-  char *end;
-  str[len] = '\0';
-  res = strtol(str, &end, 0);
-  if((((__xdata char *)end) - str) != len){
-    return ARG_ERR;
+  for(; i < len; ++i){
+    u8 c = str[i], v;
+    if((c >= '0') && (c <= '9')){
+      v = c - '0';
+    }else if((shift == 4) && ((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')){
+      v = (c | 0x20) - 'a' + 10;
+    }else{
+      return ARG_ERR;
+    }
+    if(shift == 0){
+      if(res > (0xFFFF - v) / 10){return ARG_ERR;} // overflow
+      res *= 10;
+    }else if((v >> shift) || (res >> (16 - shift))){
+      return ARG_ERR;
+    }else{
+      res <<= shift;
+    }
+    res += v;
   }
-#endif
-  return res;
+  return (res == 0xFFFF) ? ARG_ERR : (s16)res;
 }
 
 static __xdata enum {
@@ -156,6 +145,10 @@ static __xdata enum {
 } state = THROUGH;
 static __bit on_escape = FALSE;
 static __bit last_char_is_cr = FALSE;
+static __xdata char buf[XRAM_PARSER_TOKEN];
+static __xdata u8 buf_index;
+static __bit buf_overflow; // the token exceeds buf, and is not taken as a number
+static parsed_info_t parsed_info;
 
 void parser_reset(){
   state = THROUGH;
@@ -163,14 +156,8 @@ void parser_reset(){
   last_char_is_cr = FALSE;
 }
 
-#define PARSED_INFO_BUFFERD_ARGS \
-  (sizeof(((parsed_info_t *)(0))->arg) / sizeof(((parsed_info_t *)(0))->arg[0]))
-
 /* Parse Prologix protocol and run command */
 void parse(char c){
-  static __xdata char buf[16];
-  static __xdata u8 buf_index;
-  static parsed_info_t parsed_info;
   enum {CHAR_NORMAL, CHAR_PLUS, CHAR_TERMINATOR, CHAR_SEPARATOR} c_attr = CHAR_NORMAL;
   __bit current_char_is_cr = FALSE;
 
@@ -208,6 +195,8 @@ void parse(char c){
       if(c_attr == CHAR_PLUS){
         state = ON_COMMAND_OR_ARG;
         buf_index = 0;
+        buf_overflow = FALSE;
+        parsed_info.cmd = CMD_ERROR; // "++" without command must not be taken as data
         parsed_info.args = -1;
         break;
       }
@@ -231,6 +220,8 @@ void parse(char c){
       if(c_attr == CHAR_NORMAL){
         if(buf_index < (sizeof(buf) - 1)){
           buf[buf_index++] = c;
+        }else{
+          buf_overflow = TRUE;
         }
         break;
       }
@@ -242,19 +233,84 @@ void parse(char c){
           parsed_info.cmd = check_cmd(buf, buf_index);
         }else{
           // check arg in buf.
-          while(parsed_info.args <= PARSED_INFO_BUFFERD_ARGS){
+          while(parsed_info.args < PARSED_INFO_ARGS){ // the rest is dropped
+            __bit keyword = FALSE; // the position takes a keyword, whose code is a number from ARG_EOI
             if((parsed_info.cmd == CMD_READ) && (parsed_info.args == 0)){
+              keyword = TRUE;
               if((buf_index == 3) && (memcmp(buf, "eoi", buf_index) == 0)){
                 parsed_info.arg[parsed_info.args] = ARG_EOI;
                 break;
               }
             }
-            parsed_info.arg[parsed_info.args] = check_arg(buf, buf_index);
+            if(parsed_info.cmd == CMD_TRG){
+              keyword = TRUE;
+              if((buf_index == 2) && (memcmp(buf, "ts", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_TS;
+                break;
+              }
+              if((buf_index == 4) && (memcmp(buf, "read", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_READ;
+                break;
+              }
+            }
+            if(((parsed_info.cmd == CMD_STATS) || (parsed_info.cmd == CMD_HIST))
+                && (parsed_info.args == 0)){
+              keyword = TRUE;
+              if((buf_index == 5) && (memcmp(buf, "reset", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_RESET;
+                break;
+              }
+            }
+            if((parsed_info.cmd == CMD_SAVECFG) && (parsed_info.args == 0)){
+              keyword = TRUE;
+              if((buf_index == 6) && (memcmp(buf, "status", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_STATUS;
+                break;
+              }
+            }
+            if((parsed_info.cmd == CMD_RST) && (parsed_info.args == 0)){
+              keyword = TRUE;
+              if((buf_index == 4) && (memcmp(buf, "soft", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_SOFT;
+                break;
+              }
+            }
+            if((parsed_info.cmd == CMD_PROFILE) && (parsed_info.args == 0)){
+              keyword = TRUE;
+              if((buf_index == 4) && (memcmp(buf, "save", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_SAVE;
+                break;
+              }
+              if((buf_index == 4) && (memcmp(buf, "load", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_LOAD;
+                break;
+              }
+            }
+            if((parsed_info.cmd == CMD_MACRO) && (parsed_info.args == 0)){
+              keyword = TRUE;
+              if((buf_index == 3) && (memcmp(buf, "def", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_DEF;
+                break;
+              }
+              if((buf_index == 3) && (memcmp(buf, "run", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_RUN;
+                break;
+              }
+              if((buf_index == 3) && (memcmp(buf, "end", buf_index) == 0)){
+                parsed_info.arg[parsed_info.args] = ARG_END;
+                break;
+              }
+            }
+            parsed_info.arg[parsed_info.args] = buf_overflow ? ARG_ERR : check_arg(buf, buf_index);
+            if(keyword && ((u16)parsed_info.arg[parsed_info.args] >= ARG_EOI)){
+              parsed_info.arg[parsed_info.args] = ARG_ERR; // not to be taken as a keyword
+            }
             break;
           }
         }
         buf_index = 0;
-        parsed_info.args++;
+        buf_overflow = FALSE;
+        if(parsed_info.args < PARSED_INFO_ARGS){parsed_info.args++;}
       }
 
       if(c_attr == CHAR_TERMINATOR){
@@ -58,6 +58,15 @@ enum command_t {
   CMD_VER,
   CMD_HELP,
   CMD_DEBUG,
+  CMD_TX,
+  CMD_SCHED,
+  CMD_TSTAMP,
+  CMD_CAPTURE,
+  CMD_SNIFF,
+  CMD_STATS,
+  CMD_HIST,
+  CMD_PROFILE,
+  CMD_MACRO,
   CMD_INPUTABLE,
   CMD_ERROR = CMD_INPUTABLE,
   CMD_TALK,
@@ -67,16 +76,30 @@ extern const __code char * __code command_str[CMD_INPUTABLE];
 
 void parser_reset();
 
+#define PARSED_INFO_ARGS 30 // ++addr with 15 pairs of primary and secondary addresses
+
 typedef __xdata struct {
-  enum command_t cmd;
-  int args;
-  int arg[30];
+  u8 cmd; // enum command_t
+  s8 args; // the number of arguments, up to PARSED_INFO_ARGS
+  s16 arg[PARSED_INFO_ARGS]; // 16-bit int as on the target, even when built for host
 } parsed_info_t;
 
 extern void run_command(parsed_info_t *info);
 void parse(char c);
 
-#define ARG_ERR -1
+#define ARG_ERR -1 // invalid, or a number over 0xFFFE
+// numbers from 0x8000 are negative; commands taking them compare arguments as u16
+// keywords, at the positions of which numbers from ARG_EOI are ARG_ERR
 #define ARG_EOI 256
+#define ARG_TS 257
+#define ARG_READ 258
+#define ARG_RESET 259
+#define ARG_STATUS 260
+#define ARG_SAVE 261
+#define ARG_LOAD 262
+#define ARG_SOFT 263
+#define ARG_DEF 264
+#define ARG_RUN 265
+#define ARG_END 266
 
 #endif /* __PARSER_H__ */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+
+#include "main.h"
+#include "stats.h"
+
+__xdata stats_t stats;
+__xdata u32 stats_boot_us = 0;
+
+static __xdata u16 loops;
+static __xdata u8 loops_tick;
+
+void stats_reset(){
+  memset(&stats, 0, sizeof(stats));
+  loops = 0;
+  loops_tick = u32_lsbyte(tickcount);
+}
+
+/**
+ * Count main loop iterations, which should be called once per iteration.
+ */
+void stats_loop(){
+  u8 tick = u32_lsbyte(tickcount);
+  loops++;
+  if((u8)(tick - loops_tick) >= 100){ // 1 sec
+    stats.loops_per_sec = loops;
+    loops = 0;
+    loops_tick = tick;
+  }
+}
+
+/**
+ * Latch the boot-to-enumeration time, which should be called
+ * when the host configures the device; the first one after reset only.
+ */
+void stats_enumerated(){
+  static __xdata timestamp_t ts;
+  if(stats_boot_us){return;}
+  timestamp_latch(&ts);
+  stats_boot_us = timestamp_to_us(&ts);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "type.h"
+
+/*
+ * Performance counters, which are always enabled.
+ * Each update is a plain increment or compare on XRAM in order to be cheap.
+ */
+typedef struct {
+  u32 bytes_written; // including commands
+  u32 bytes_read; // including commands
+  u16 timeout_nrfd; // talker waiting for NRFD high
+  u16 timeout_ndac; // talker waiting for NDAC high
+  u16 timeout_dav; // listener waiting for DAV, except idle polling in device mode
+  u16 tx_retries; // cdc_tx() waiting for IN endpoint
+  u16 tx_drops; // cdc_tx() giving up a packet
+  u16 rx_backlogs; // cdc_rx() leaving data in OUT endpoint, i.e., host may be NAKed
+  u16 loops_per_sec; // main loop iterations in the last second
+  u32 read_max_ms; // longest gpib_read(), kept raw and converted when printed
+  u16 read_max_count; // its fraction below 10 ms, in Timer3 count
+} stats_t;
+
+extern __xdata stats_t stats;
+extern __xdata u32 stats_boot_us; // from the start of the timer at boot to USB configuration, kept over stats_reset()
+
+void stats_reset();
+void stats_loop();
+void stats_enumerated();
+
+#endif /* __STATS_H__ */
@@ -36,8 +36,13 @@ typedef unsigned char u8;
 typedef signed char s8;
 typedef unsigned short u16;
 typedef signed short s16;
+#if defined(__SDCC) || defined(SDCC)
 typedef unsigned long u32;
 typedef signed long s32;
+#else
+typedef unsigned int u32; // 32-bit on ILP32 / LP64 hosts as well
+typedef signed int s32;
+#endif
 
 typedef unsigned char UCHAR;
 typedef unsigned int UINT;
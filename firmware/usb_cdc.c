@@ -39,6 +39,7 @@
 
 #include "usb_cdc.h"
 #include "util.h"
+#include "stats.h"
 
 // bitmap for set_line_state
 #define CDC_DTR     0x01
@@ -54,8 +55,6 @@
 #define CDC_OVRRUN  0x40  // overrun error
 #define CDC_CTS     0x80  // clear to send
 
-static u16 cdc_rx_size();
-
 void cdc_polling(){
   static __xdata u8 previous_frame_num = usb_frame_num & 0xF0;
   u8 current_frame_num = usb_frame_num & 0xF0; // per 16 frames
@@ -81,7 +80,7 @@ void cdc_polling(){
       0xA1, 0x20, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00,
       0x03, 0x00
     };
-    usb_write(buf, sizeof(buf), CDC_COM_EP_IN);
+    usb_write((BYTE *)buf, sizeof(buf), CDC_COM_EP_IN);
   }
 #endif
 }
@@ -329,18 +328,19 @@ static void cdc_Send_Break(){
 
 #endif
 
-u16 cdc_tx(u8 *buf, u16 size){
-  static __bit require_ZLP = FALSE;
+static __bit require_ZLP = FALSE;
 #ifdef CDC_IS_REPLACED_BY_FTDI
 #define TX_BUF_HEADER 2
-  static __xdata u8 tx_packet[CDC_DATA_EP_IN_PACKET_SIZE-1] = {
-      (HEADER0_SIGN | HEADER0_RI),    // 0x41 
-      (HEADER1_THRE | HEADER1_TEMT)}; // 0x60
+static __xdata u8 tx_packet[CDC_DATA_EP_IN_PACKET_SIZE-1] = {
+    (HEADER0_SIGN | HEADER0_RI),    // 0x41 
+    (HEADER1_THRE | HEADER1_TEMT)}; // 0x60
 #else
 #define TX_BUF_HEADER 0
-  static __xdata u8 tx_packet[CDC_DATA_EP_IN_PACKET_SIZE];
+static __xdata u8 tx_packet[CDC_DATA_EP_IN_PACKET_SIZE];
 #endif
-  static __xdata u8 margin = sizeof(tx_packet) - TX_BUF_HEADER;
+static __xdata u8 margin = sizeof(tx_packet) - TX_BUF_HEADER;
+
+u16 cdc_tx(u8 *buf, u16 size){
   u16 written = 0;
   u8 retry;
   if(size == 0){ // flush
@@ -377,18 +377,47 @@ u16 cdc_tx(u8 *buf, u16 size){
         }
         break;
       }
+      stats.tx_retries++;
       wait_us(5);
     }
+    if(retry >= 200){stats.tx_drops++;}
     written += margin;
     margin = sizeof(tx_packet) - TX_BUF_HEADER;
   }while(size);
   return written;
 }
 
+/**
+ * Transmit a packet without waiting for the endpoint,
+ * which is intended for bulk streaming from a caller's buffer.
+ * Data buffered by cdc_tx() is sent in advance to keep the order.
+ * 
+ * @param buf data, whose size should be CDC_DATA_EP_IN_PACKET_SIZE for throughput
+ * @param size size of data
+ * @return 0 when the endpoint is busy, otherwise size
+ */
+u16 cdc_tx_packet(u8 *buf, u16 size){
+#ifdef CDC_IS_REPLACED_BY_FTDI
+  return cdc_tx(buf, size); // each packet requires the header.
+#else
+  if(margin < sizeof(tx_packet)){
+    if(usb_write(tx_packet, sizeof(tx_packet) - margin, CDC_DATA_EP_IN) == 0){
+      return 0;
+    }
+    margin = sizeof(tx_packet);
+  }
+  if(usb_write(buf, size, CDC_DATA_EP_IN) == 0){
+    return 0;
+  }
+  require_ZLP = (size == CDC_DATA_EP_IN_PACKET_SIZE);
+  return size;
+#endif
+}
+
 #ifdef CDC_IS_REPLACED_BY_FTDI
 static __bit cdc_rx_need_skip = 1;
 
-static u16 cdc_rx_size(){
+u16 cdc_rx_size(){
   
   // The first byte is a control byte.
   u16 stored = usb_count_ep_out(CDC_DATA_EP_OUT); 
@@ -410,18 +439,22 @@ static u16 cdc_rx_size(){
 
 u16 cdc_rx(u8 *buf, u16 size){
   // The first byte is a control byte.
-  if(cdc_rx_size() <= size){
+  u16 stored = cdc_rx_size();
+  if(stored <= size){
     cdc_rx_need_skip = 1;
+  }else{
+    stats.rx_backlogs++;
   }
   return usb_read(buf, size, CDC_DATA_EP_OUT);
 }
 #else
 
-static u16 cdc_rx_size(){
+u16 cdc_rx_size(){
   return usb_count_ep_out(CDC_DATA_EP_OUT);
 }
 
 u16 cdc_rx(u8 *buf, u16 size){
+  if(cdc_rx_size() > size){stats.rx_backlogs++;}
   return usb_read(buf, size, CDC_DATA_EP_OUT);
 }
 #endif
@@ -86,12 +86,18 @@ typedef struct {
 
 #define cdc_config_length() sizeof(cdc_descriptor_t)
 
+#if !(defined(__SDCC) || defined(SDCC))
+#pragma pack(push, 1) // host build; 7 bytes on the wire
+#endif
 typedef struct {
   DWORD_t baudrate;
   BYTE stopbit;
   BYTE parity;
   BYTE databit;
 } cdc_line_coding_t;
+#if !(defined(__SDCC) || defined(SDCC))
+#pragma pack(pop)
+#endif
 
 // Descriptor type (Class specific)
 #define DSC_TYPE_CS_INTERFACE       0x24
@@ -111,7 +117,9 @@ typedef struct {
 void usb_CDC_req();
 void cdc_polling();
 u16 cdc_tx(u8 *buf, u16 size);
+u16 cdc_tx_packet(u8 *buf, u16 size);
 u16 cdc_rx(u8 *buf, u16 size);
+u16 cdc_rx_size();
 
 #define CDC_COM_EP_IN  1
 #define CDC_DATA_EP_IN  2
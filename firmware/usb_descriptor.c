@@ -187,7 +187,7 @@ const __code endpoint_descriptor_t DESC_ENDPOINT3 = {
 }; //end of ENDPOINT3
 
 const __code  BYTE DESC_STRING1[] = {
-  sizeof(DESC_STRING1), DSC_TYPE_STRING,
+  (2 + 11 * 2), DSC_TYPE_STRING, // bLength
   'n', 0,
   'a', 0,
   'r', 0,
@@ -202,7 +202,7 @@ const __code  BYTE DESC_STRING1[] = {
 }; //end of String1_Desc
 
 const __code BYTE DESC_STRING2[] = {
-  sizeof(DESC_STRING2), DSC_TYPE_STRING,
+  (2 + 8 * 2), DSC_TYPE_STRING, // bLength
   'g', 0,
   'p', 0,
   'i', 0,
@@ -214,7 +214,7 @@ const __code BYTE DESC_STRING2[] = {
 }; //end of String2_Desc
 
 const __code BYTE DESC_STRING3[] = {
-  sizeof(DESC_STRING3), DSC_TYPE_STRING,
+  (2 + 8 * 2), DSC_TYPE_STRING, // bLength
   'C', 0,
   'D', 0,
   'C', 0,
@@ -48,6 +48,8 @@ void usb_class_request(){
       usb_CDC_req();
       break;
 #endif
+    default:
+      break;
   }
 }
 
@@ -58,8 +58,8 @@ static const __code BYTE ONES_PACKET[2] = {0x01, 0x00};
 // communication with host
 static const __code BYTE ZERO_PACKET[2] = {0x00, 0x00};
 
-static __code device_descriptor_t * __xdata desc_device;
-static __code configuration_descriptor_t * __xdata desc_config;
+static const __code device_descriptor_t * __xdata desc_device;
+static const __code configuration_descriptor_t * __xdata desc_config;
 
 
 /**
@@ -325,7 +325,7 @@ static void get_descriptor(){
       break;
     case DSC_TYPE_STRING:
       if(ep0_setup.wValue.c[LSB] == 0){return;}
-      ep0_data.buf = DESC_STRINGs[ep0_setup.wValue.c[LSB]-1];
+      ep0_data.buf = (BYTE *)DESC_STRINGs[ep0_setup.wValue.c[LSB]-1];
       // Can have a maximum of 255 strings
       ep0_data.size = *ep0_data.buf;
       break;
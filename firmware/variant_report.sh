@@ -0,0 +1,21 @@
+#!/bin/sh
+# Report code size of a firmware variant, and cycles per byte of its benchmark image.
+# usage: variant_report.sh name image.hex [bench.ihx]
+
+NAME=$1
+IMAGE=$2
+BENCH=$3
+
+# sum of the data records of Intel HEX
+SIZE=$(awk '
+  /^:/ && substr($0, 8, 2) == "00" {
+    n = 0
+    for(i = 2; i <= 3; i++){n = n * 16 + index("0123456789ABCDEF", toupper(substr($0, i, 1))) - 1}
+    size += n
+  }
+  END {print size + 0}' ${IMAGE})
+echo "== ${NAME}: code ${SIZE} bytes"
+
+if [ -n "${BENCH}" ]; then
+  sh $(dirname $0)/bench/run_bench.sh ${BENCH} -
+fi
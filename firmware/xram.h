@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XRAM_H__
+#define __XRAM_H__
+
+/*
+ * XRAM plan; 1 KB (0x0000-0x03ff, --xram-size of the Makefile),
+ * which is allocated statically by the linker. "make xram-report"
+ * prints the exact usage per module of the last build.
+ *
+ * module          bytes (approx.)  main owners
+ * gpib.c          440   gpib_config, mode arena, ++addr scratch, rx chunk, ++macro
+ * config_store.c   80   snapshot of the background save
+ * parser.c         80   parsed_info_t, token
+ * usb_cdc.c        80   IN packet, line coding
+ * f38x_usb.c       40   EP0 setup and endpoint states
+ * stats.c          40   ++stats counters
+ * gpib_io.c        35   timestamps (+128 with GPIB_IO_HISTOGRAM)
+ * others           20   tick counters, flash and descriptor states
+ *
+ * The buffers of the modes which never run at the same time share
+ * the mode arena of gpib.c; ++sched jobs in controller mode,
+ * and the ring of ++capture / ++sniff in device mode.
+ * The ring stays 256 bytes, because its u8 indices keep the capture
+ * path cheap, and a larger one would not fit with the histograms.
+ */
+#define XRAM_SIZE 0x400
+#define XRAM_MODE_ARENA 0x100 // ring of ++capture / ++sniff, indexed by u8
+#define XRAM_PARSER_TOKEN 16 // command or argument of the parser
+#define XRAM_RX_CHUNK 16 // input taken from the OUT endpoint at once
+
+#endif /* __XRAM_H__ */
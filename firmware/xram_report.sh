@@ -0,0 +1,40 @@
+#!/bin/sh
+# Print XRAM usage per module from the object files (.rel) of sdcc.
+# usage: xram_report.sh xram_size file.rel ...
+# Sizes of the areas XSEG (xdata), XISEG (initialized xdata) and PSEG (pdata) are summed.
+
+XRAM_SIZE=$1
+shift
+
+awk -v xram_size=${XRAM_SIZE} '
+  function hex(str,  i, res){
+    res = 0
+    str = tolower(str)
+    sub(/^0x/, "", str)
+    for(i = 1; i <= length(str); i++){
+      res = res * 16 + index("0123456789abcdef", substr(str, i, 1)) - 1
+    }
+    return res
+  }
+  FNR == 1 {radix = 16; module = FILENAME; sub(/^.*\//, "", module); sub(/\.rel$/, "", module)}
+  $1 == "XL" || $1 == "XL2" || $1 == "XL3" || $1 == "XL4" {radix = 16}
+  $1 == "XD" || $1 == "XD2" || $1 == "XD3" || $1 == "XD4" {radix = 10}
+  $1 == "M" {module = $2}
+  $1 == "A" && ($2 == "XSEG" || $2 == "XISEG" || $2 == "PSEG") && $3 == "size" {
+    size = (radix == 16) ? hex($4) : $4 + 0
+    if(!(module in used)){order[n++] = module}
+    used[module] += size
+    if($2 == "XISEG"){initialized[module] += size}
+    total += size
+  }
+  END {
+    printf("%-16s %6s %6s\n", "module", "xdata", "(init)")
+    for(i = 0; i < n; i++){
+      if(used[order[i]] == 0){continue}
+      printf("%-16s %6d %6d\n", order[i], used[order[i]], initialized[order[i]])
+    }
+    limit = (xram_size ~ /^0[xX]/) ? hex(xram_size) : xram_size + 0
+    printf("%-16s %6d / %d bytes, %d free\n", "total", total, limit, limit - total)
+    if(total > limit){exit 1}
+  }
+' "$@"
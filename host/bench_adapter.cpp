@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Throughput and latency benchmark of the host library (lib/gpib_adapter.h),
+ * intended to be run against sim_adapter, or a real adapter with instruments.
+ *
+ * usage: bench_adapter [-n queries] [-d depth] [-e echo_pad] [-b block_pad] [-w listener_pad] tty
+ *   echo_pad      replies with the query (sim_adapter -e)
+ *   block_pad     replies with a binary block to "DATA?" (sim_adapter -b)
+ *   listener_pad  accepts anything (sim_adapter -w)
+ * A negative pad skips the corresponding test.
+ * "make bench-adapter" runs this with sim_adapter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+
+#include "lib/gpib_adapter.h"
+
+using gpib_usb::Adapter;
+
+static double now_sec(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+static void sequential(Adapter &adapter, int pad, int n){
+  std::vector<double> latency;
+  double start(now_sec());
+  for(int i(0); i < n; ++i){
+    double t(now_sec());
+    adapter.query(pad, "*IDN?");
+    latency.push_back(now_sec() - t);
+  }
+  double total(now_sec() - start);
+  std::sort(latency.begin(), latency.end());
+  printf("sequential: %d queries, %.1f queries/s, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+      n, n / total, latency[n / 2] * 1E3, latency[n * 99 / 100] * 1E3, latency.back() * 1E3);
+}
+
+static void pipelined(Adapter &adapter, int pad, int n, int depth){
+  std::deque<uint64_t> tickets;
+  double start(now_sec());
+  for(int i(0); i < n; ++i){
+    if((int)tickets.size() >= depth){
+      adapter.wait(tickets.front());
+      tickets.pop_front();
+    }
+    tickets.push_back(adapter.submit(pad, "*IDN?"));
+  }
+  while(!tickets.empty()){
+    adapter.wait(tickets.front());
+    tickets.pop_front();
+  }
+  double total(now_sec() - start);
+  printf("pipelined (depth %d): %d queries, %.1f queries/s\n", depth, n, n / total);
+}
+
+static void bulk_write(Adapter &adapter, int pad, size_t size){
+  std::string chunk(1022, '\0');
+  for(size_t i(0); i < chunk.size(); ++i){chunk[i] = (char)(i * 13);} // with characters to be escaped
+  adapter.command("eos 3"); // no terminator appended
+  char buf[16];
+  snprintf(buf, sizeof(buf), "addr %d", pad);
+  adapter.command(buf);
+  uint64_t written_before(adapter.bytes_written);
+  double start(now_sec());
+  for(size_t i(0); i < size; i += chunk.size()){adapter.write(chunk);}
+  adapter.wait(adapter.submit_command("ver"), 60000); // synchronize
+  double total(now_sec() - start);
+  printf("bulk write: %zu bytes (%llu bytes escaped), %.1f kB/s, %llu write(2) calls\n",
+      size, (unsigned long long)(adapter.bytes_written - written_before),
+      size / total / 1E3, (unsigned long long)adapter.writes);
+  adapter.command("eos 0");
+}
+
+static void bulk_read(Adapter &adapter, int pad){
+  uint64_t reads_before(adapter.reads);
+  double start(now_sec());
+  std::string block(adapter.query(pad, "DATA?", Adapter::FRAME_BLOCK));
+  double total(now_sec() - start);
+  printf("bulk read: %zu bytes, %.1f kB/s, %llu read(2) calls\n",
+      block.size(), block.size() / total / 1E3,
+      (unsigned long long)(adapter.reads - reads_before));
+}
+
+int main(int argc, char *argv[]){
+  int n(1000), depth(8), echo_pad(5), block_pad(9), listener_pad(10);
+  int opt;
+  while((opt = getopt(argc, argv, "n:d:e:b:w:")) != -1){
+    switch(opt){
+      case 'n': n = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 'e': echo_pad = atoi(optarg); break;
+      case 'b': block_pad = atoi(optarg); break;
+      case 'w': listener_pad = atoi(optarg); break;
+      default: optind = argc + 1;
+    }
+  }
+  if((optind != argc - 1) || (n <= 0) || (depth <= 0)){
+    fprintf(stderr, "usage: %s [-n queries] [-d depth] [-e echo_pad] [-b block_pad] [-w listener_pad] tty\n", argv[0]);
+    return 2;
+  }
+
+  try{
+    Adapter adapter(argv[optind]);
+    adapter.command("auto 0");
+    adapter.command("eos 0");
+    printf("adapter: %s", adapter.wait(adapter.submit_command("ver")).c_str());
+
+    if(echo_pad >= 0){
+      sequential(adapter, echo_pad, n);
+      pipelined(adapter, echo_pad, n, depth);
+    }
+    if(listener_pad >= 0){bulk_write(adapter, listener_pad, 1 << 20);}
+    if(block_pad >= 0){bulk_read(adapter, block_pad);}
+  }catch(gpib_usb::Error &e){
+    fprintf(stderr, "error: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * HiSLIP client checking and benchmarking hislip_bridge.
+ *
+ * usage: bench_hislip [-p port] [-n queries] [-d depth] [-a sub-address] [host]
+ *   The device at sub-address (default gpib0,5) should echo the query,
+ *   as the echo instrument of sim_adapter does.
+ * "make bench-hislip" runs this with the bridge in both modes against sim_adapter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+#include "lib/hislip.h"
+
+using namespace hislip;
+
+
+static double now_sec(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+class Channel {
+  int fd;
+public:
+  Channel(const char *host, int port) : fd(-1) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    std::ostringstream ss;
+    ss << port;
+    if(getaddrinfo(host, ss.str().c_str(), &hints, &res) != 0){throw std::runtime_error("getaddrinfo");}
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if((fd < 0) || (connect(fd, res->ai_addr, res->ai_addrlen) < 0)){
+      freeaddrinfo(res);
+      throw std::runtime_error("connect");
+    }
+    freeaddrinfo(res);
+    int one(1);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  ~Channel(){if(fd >= 0){close(fd);}}
+  void send(uint8_t type, uint8_t control, uint32_t param, const std::string &payload = std::string()){
+    std::string buf(header_t(type, control, param, payload.size()).encode() + payload);
+    for(size_t pos(0); pos < buf.size(); ){
+      ssize_t n(::send(fd, buf.data() + pos, buf.size() - pos, MSG_NOSIGNAL));
+      if(n <= 0){throw std::runtime_error("send");}
+      pos += n;
+    }
+  }
+  void read_fully(char *buf, size_t size){
+    while(size > 0){
+      ssize_t n(::recv(fd, buf, size, 0));
+      if(n <= 0){throw std::runtime_error("recv");}
+      buf += n;
+      size -= n;
+    }
+  }
+  header_t receive(std::string &payload){
+    char buf[header_t::size];
+    read_fully(buf, sizeof(buf));
+    header_t h;
+    if(!h.decode(buf)){throw std::runtime_error("bad header");}
+    payload.resize(h.length);
+    if(h.length > 0){read_fully(&payload[0], h.length);}
+    if((h.type == ERROR) || (h.type == FATAL_ERROR)){throw std::runtime_error("server error: " + payload);}
+    return h;
+  }
+  header_t expect(uint8_t type, std::string &payload){
+    header_t h(receive(payload));
+    if(h.type != type){
+      std::ostringstream ss;
+      ss << "unexpected message type " << (int)h.type << " (" << (int)type << " expected)";
+      throw std::runtime_error(ss.str());
+    }
+    return h;
+  }
+};
+
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+  if(!(cond)){ \
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } \
+}while(0)
+
+class Session {
+public:
+  Channel sync, async;
+  bool overlapped;
+  uint32_t message_id;
+  Session(const char *host, int port, const std::string &sub_address)
+      : sync(host, port), async(host, port), message_id(FIRST_MESSAGE_ID) {
+    std::string payload;
+    sync.send(INITIALIZE, 0, (PROTOCOL_VERSION << 16) | ('B' << 8) | 'H', sub_address);
+    header_t h(sync.expect(INITIALIZE_RESPONSE, payload));
+    overlapped = (h.control & 1);
+    async.send(ASYNC_INITIALIZE, 0, h.param & 0xFFFF);
+    async.expect(ASYNC_INITIALIZE_RESPONSE, payload);
+    async.send(ASYNC_MAXIMUM_MESSAGE_SIZE, 0, 0, encode_u64(1 << 20));
+    async.expect(ASYNC_MAXIMUM_MESSAGE_SIZE_RESPONSE, payload);
+  }
+  uint32_t send(const std::string &msg){
+    uint32_t id(message_id);
+    sync.send(DATA_END, 0, id, msg);
+    message_id += 2;
+    return id;
+  }
+  std::string reply(uint32_t id){
+    std::string res, payload;
+    while(true){
+      header_t h(sync.receive(payload));
+      CHECK(((h.type == DATA) || (h.type == DATA_END)) && (h.param == id));
+      res += payload;
+      if(h.type == DATA_END){return res;}
+    }
+  }
+};
+
+static void check_functions(Session &s){
+  std::string payload;
+  CHECK(s.reply(s.send("*IDN?\n")) == "*IDN?\n");
+  s.sync.send(TRIGGER, 0, s.message_id); // no reply
+  s.message_id += 2;
+  CHECK(s.reply(s.send("A;B?\n")) == "A;B?\n");
+
+  s.async.send(ASYNC_STATUS_QUERY, 0, s.message_id);
+  s.async.expect(ASYNC_STATUS_RESPONSE, payload);
+
+  s.async.send(ASYNC_LOCK, 1, 1000); // exclusive
+  CHECK(s.async.expect(ASYNC_LOCK_RESPONSE, payload).control == 1);
+  s.async.send(ASYNC_LOCK_INFO, 0, 0);
+  CHECK(s.async.expect(ASYNC_LOCK_INFO_RESPONSE, payload).control == 1);
+  s.async.send(ASYNC_LOCK, 0, s.message_id); // release
+  CHECK(s.async.expect(ASYNC_LOCK_RESPONSE, payload).control == 1);
+
+  s.async.send(ASYNC_DEVICE_CLEAR, 0, 0);
+  s.async.expect(ASYNC_DEVICE_CLEAR_ACKNOWLEDGE, payload);
+  s.sync.send(DEVICE_CLEAR_COMPLETE, 0, 0);
+  s.sync.expect(DEVICE_CLEAR_ACKNOWLEDGE, payload);
+  s.message_id = FIRST_MESSAGE_ID;
+
+  CHECK(s.reply(s.send("AFTER:CLEAR?\n")) == "AFTER:CLEAR?\n");
+}
+
+// a device which does not answer; every query still has a reply
+static void check_mute(const char *host, int port){
+  Session s(host, port, "gpib0,29");
+  CHECK(s.reply(s.send("MUTE?\n")).empty());
+  CHECK(s.reply(s.send("MUTE?\n")).empty());
+}
+
+static void bench(Session &s, int n, int depth){
+  double start(now_sec());
+  int sent(0), received(0);
+  uint32_t first_id(s.message_id);
+  while(received < n){
+    while((sent < n) && (sent - received < depth)){
+      std::ostringstream ss;
+      ss << "MEAS" << sent << "?\n";
+      s.send(ss.str());
+      sent++;
+    }
+    std::ostringstream ss;
+    ss << "MEAS" << received << "?\n";
+    CHECK(s.reply(first_id + received * 2) == ss.str());
+    received++;
+  }
+  double total(now_sec() - start);
+  printf("%s mode, depth %d: %d queries, %.1f queries/s\n",
+      s.overlapped ? "overlapped" : "synchronized", depth, n, n / total);
+}
+
+int main(int argc, char *argv[]){
+  int port(4880), n(1000), depth(16);
+  std::string sub_address("gpib0,5");
+  int opt;
+  while((opt = getopt(argc, argv, "p:n:d:a:")) != -1){
+    switch(opt){
+      case 'p': port = atoi(optarg); break;
+      case 'n': n = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 'a': sub_address = optarg; break;
+      default: optind = argc + 1;
+    }
+  }
+  if((optind < argc - 1) || (n <= 0) || (depth <= 0)){
+    fprintf(stderr, "usage: %s [-p port] [-n queries] [-d depth] [-a sub-address] [host]\n", argv[0]);
+    return 2;
+  }
+  const char *host((optind < argc) ? argv[optind] : "127.0.0.1");
+
+  try{
+    Session s(host, port, sub_address);
+    check_functions(s);
+    check_mute(host, port);
+    bench(s, n, 1);
+    bench(s, n, depth);
+  }catch(std::exception &e){
+    fprintf(stderr, "error: %s\n", e.what());
+    return 1;
+  }
+  if(failures > 0){
+    printf("FAILED (%d failure(s))\n", failures);
+    return 1;
+  }
+  return 0;
+}
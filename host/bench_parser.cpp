@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Benchmark and fuzz test of the command parser (firmware/parser.c) on host.
+ *
+ * usage: bench_parser [-m MB] [-f streams] [-s seed] [file ...]
+ *   Each corpus, built in (Prologix commands, data lines, escaped binary block,
+ *   too many or too long arguments) or read from the files as raw streams,
+ *   is parsed repeatedly up to MB megabytes (default 16) for commands/s and bytes/s.
+ *   Then random streams (default 10000) are parsed while the parser state
+ *   (on_escape, last_char_is_cr, buf_index) and the arguments to run_command()
+ *   are checked against the protocol, and so are random numeric arguments
+ *   against a reference conversion. It returns non-zero on any violation.
+ * "make bench-parser" runs this.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// The parser is included to inspect its static state.
+#include "parser.c"
+
+static struct {
+  unsigned long commands, talks, terminators;
+  const char *error;
+  int arg[2]; // of the last command, in 16-bit int as on the target
+} result;
+
+void run_command(parsed_info_t *info){
+  if(info->cmd == CMD_TALK){
+    switch(info->args){
+      case 0: result.terminators++; return;
+      case 1: result.talks++; return;
+    }
+    result.error = "talk with other than 0 or 1 argument";
+    return;
+  }
+  result.commands++;
+  result.arg[0] = (info->args > 0) ? info->arg[0] : ARG_ERR;
+  result.arg[1] = (info->args > 1) ? info->arg[1] : ARG_ERR;
+  if(info->cmd > CMD_ERROR){
+    result.error = "unknown command";
+  }else if((info->args < 0) && ((info->cmd != CMD_ERROR) || (info->args < -1))){
+    result.error = "negative arguments";
+  }else if(info->args > PARSED_INFO_ARGS){
+    result.error = "arguments overflow";
+  }
+}
+
+static double now_sec(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1E-9 * ts.tv_nsec;
+}
+
+static void escape(std::string &out, char c){
+  switch(c){
+    case '+': case '\r': case '\n': case 0x1B:
+      out += (char)0x1B;
+  }
+  out += c;
+}
+
+static unsigned rand_seed = 1;
+static unsigned next_rand(){ // xorshift32
+  rand_seed ^= rand_seed << 13;
+  rand_seed ^= rand_seed >> 17;
+  rand_seed ^= rand_seed << 5;
+  return rand_seed;
+}
+
+struct corpus_t {
+  std::string name, stream;
+};
+
+static std::vector<corpus_t> built_in_corpora(){
+  std::vector<corpus_t> res;
+  {
+    static const char *lines[] = {
+      "++addr 5", "++auto 1", "++read eoi", "++eos 2", "++eoi 1", "++trg ts read",
+      "++mode 1", "++ver", "++read_tmo_ms 500", "++addr 5 96", "++spoll 4", "++srq",
+      "++tx 1 5", "++eot_enable 1", "++eot_char 0x0A", "++stats reset", "++clr", "++loc",
+      "++ifc", "++status 0b01000000", "++savecfg status", "++rst soft", "++unknown 1",
+    };
+    corpus_t c = {"commands"};
+    for(unsigned i(0); i < sizeof(lines) / sizeof(lines[0]); ++i){
+      c.stream += lines[i];
+      c.stream += (i % 2) ? "\r\n" : "\n";
+    }
+    res.push_back(c);
+  }
+  {
+    static const char *lines[] = {
+      "*IDN?", "*RST", "*CLS", ":SENS:FUNC \"VOLT:DC\"", "MEAS:VOLT:DC? 10,0.001",
+      ":TRIG:SOUR BUS", ":INIT", "*TRG", ":FETC?", "SYST:ERR?", ":CALC:LIM:UPP 1.5E+00",
+    };
+    corpus_t c = {"data"};
+    for(unsigned i(0); i < sizeof(lines) / sizeof(lines[0]); ++i){
+      c.stream += lines[i];
+      c.stream += "\n";
+    }
+    res.push_back(c);
+  }
+  {
+    corpus_t c = {"binary"};
+    std::string block("#44096");
+    for(int i(0); i < 4096; ++i){block += (char)next_rand();}
+    c.stream = ":TRAC:DATA ";
+    for(unsigned i(0); i < block.size(); ++i){escape(c.stream, block[i]);}
+    c.stream += "\n";
+    res.push_back(c);
+  }
+  {
+    corpus_t c = {"many_args"};
+    c.stream = "++addr";
+    for(int i(0); i < 40; ++i){
+      char buf[8];
+      snprintf(buf, sizeof(buf), " %d", 1 + (i % 30));
+      c.stream += buf;
+    }
+    c.stream += "\n++addr 12345678901234567890123456789 0x123456789 0b10101010101010101010\n";
+    c.stream += "++ " "++read_tmo_ms_too_long_command 1\n";
+    res.push_back(c);
+  }
+  return res;
+}
+
+static bool read_corpus(const char *fname, corpus_t &c){
+  FILE *fp(fopen(fname, "rb"));
+  if(!fp){return false;}
+  c.name = fname;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), fp)) > 0){c.stream.append(buf, n);}
+  fclose(fp);
+  return true;
+}
+
+// Expected state after a character, which is reproduced from the protocol.
+struct model_t {
+  bool escaped, cr;
+  model_t() : escaped(false), cr(false) {}
+  void reset(){escaped = cr = false;}
+  // @return true when the character terminates the line
+  bool update(char c){
+    if(escaped){
+      escaped = cr = false;
+      return false;
+    }
+    switch(c){
+      case 0x1B: escaped = true; return false;
+      case '\r': cr = true; return true;
+      case '\n':
+        if(cr){cr = false; return false;} // CR LF
+        return true;
+    }
+    cr = false;
+    return false;
+  }
+};
+
+static const char *check_state(const model_t &model, bool terminated){
+  if(on_escape != model.escaped){return "on_escape";}
+  if(last_char_is_cr != model.cr){return "last_char_is_cr";}
+  if(buf_index >= sizeof(buf)){return "buf_index";}
+  if(terminated && (state != THROUGH)){return "state after terminator";}
+  return NULL;
+}
+
+// @return offset of the first violation, or -1
+static long parse_checked(const std::string &stream){
+  model_t model;
+  for(unsigned i(0); i < stream.size(); ++i){
+    parse(stream[i]);
+    bool terminated(model.update(stream[i]));
+    if(!result.error){result.error = check_state(model, terminated);}
+    if(result.error){return (long)i;}
+  }
+  return -1;
+}
+
+static std::string random_stream(unsigned len){
+  static const char special[] = {'+', '+', ' ', '\r', '\n', 0x1B, '0', 'x', 'b'};
+  static const char *words[] = {"++addr", "++read", "eoi", "++trg", "ts", "++tx", "++eos", "65535"};
+  std::string res;
+  while(res.size() < len){
+    unsigned r(next_rand());
+    switch(r % 4){
+      case 0: res += special[(r >> 8) % sizeof(special)]; break;
+      case 1: res += words[(r >> 8) % (sizeof(words) / sizeof(words[0]))]; break;
+      case 2: res += (char)('0' + ((r >> 8) % 10)); break;
+      default: res += (char)(r >> 8); break;
+    }
+  }
+  return res;
+}
+
+// Reference of a numeric argument: the value when it fits in 0-0xFFFE as 16-bit int, otherwise ARG_ERR
+static int arg_expected(const std::string &str){
+  unsigned base(10), i(0);
+  if(str.size() >= sizeof(buf)){return ARG_ERR;} // the token is truncated
+  if((str.size() > 2) && (str[0] == '0')){
+    switch(str[1]){
+      case 'x': case 'X': base = 16; i = 2; break;
+      case 'b': case 'B': base = 2; i = 2; break;
+    }
+  }
+  unsigned long long res(0);
+  for(; i < str.size(); ++i){
+    int v(-1);
+    char c(str[i]);
+    if((c >= '0') && (c <= '9')){
+      v = c - '0';
+    }else if((base == 16) && (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f'))){
+      v = (c | 0x20) - 'a' + 10;
+    }
+    if((v < 0) || ((unsigned)v >= base)){return ARG_ERR;}
+    res = res * base + v;
+    if(res > 0xFFFE){return ARG_ERR;}
+  }
+  return (s16)res;
+}
+
+static std::string random_number(){
+  static const char *prefixes[] = {"", "", "0x", "0X", "0b", "0"};
+  static const char digits[] = "0123456789abcdefABCDEFg";
+  unsigned r(next_rand());
+  std::string res(prefixes[r % (sizeof(prefixes) / sizeof(prefixes[0]))]);
+  unsigned len(1 + ((r >> 8) % 20));
+  unsigned range((res.size() < 2) ? 10 : ((res[1] | 0x20) == 'x') ? 22 : 2);
+  if(((r >> 16) % 16) == 0){range = sizeof(digits) - 1;} // occasionally invalid
+  while(len-- > 0){res += digits[next_rand() % range];}
+  return res;
+}
+
+// @return the number of failures
+static int check_args(unsigned count){
+  int failures(0);
+  static const struct {
+    const char *line;
+    int arg[2];
+  } cases[] = {
+    {"++read_tmo_ms 65534\n", {-2, ARG_ERR}}, // negative, which the commands read as u16
+    {"++read_tmo_ms 32768\n", {-32768, ARG_ERR}},
+    {"++read_tmo_ms 32767\n", {32767, ARG_ERR}},
+    {"++read_tmo_ms 65535\n", {ARG_ERR, ARG_ERR}},
+    {"++read_tmo_ms 65536\n", {ARG_ERR, ARG_ERR}},
+    {"++read_tmo_ms 0x10001\n", {ARG_ERR, ARG_ERR}},
+    {"++read_tmo_ms 0b1111111111111\n", {0x1FFF, ARG_ERR}},
+    {"++read_tmo_ms 0b11111111111111111\n", {ARG_ERR, ARG_ERR}}, // longer than the token buffer
+    {"++read_tmo_ms 0xFFFF\n", {ARG_ERR, ARG_ERR}},
+    {"++read_tmo_ms 99999999999999999999\n", {ARG_ERR, ARG_ERR}},
+    {"++read eoi\n", {ARG_EOI, ARG_ERR}},
+    {"++read 0x100\n", {ARG_ERR, ARG_ERR}}, // not ARG_EOI
+    {"++read 255\n", {255, ARG_ERR}},
+    {"++rst 263\n", {ARG_ERR, ARG_ERR}}, // not ARG_SOFT
+    {"++macro 266 0\n", {ARG_ERR, 0}}, // not ARG_END
+    {"++sched 0 256\n", {0, 256}}, // not a keyword position
+  };
+  for(unsigned i(0); i < sizeof(cases) / sizeof(cases[0]); ++i){
+    parser_reset();
+    for(const char *c(cases[i].line); *c; ++c){parse(*c);}
+    if((result.arg[0] != cases[i].arg[0]) || (result.arg[1] != cases[i].arg[1])){
+      fprintf(stderr, "args of \"%.*s\": %d %d\n", (int)strlen(cases[i].line) - 1, cases[i].line,
+          result.arg[0], result.arg[1]);
+      failures++;
+    }
+  }
+  for(unsigned i(0); i < count; ++i){
+    std::string str(random_number());
+    std::string line("++read_tmo_ms " + str + "\n");
+    parser_reset();
+    for(unsigned j(0); j < line.size(); ++j){parse(line[j]);}
+    if(result.arg[0] != arg_expected(str)){
+      fprintf(stderr, "argument %s: %d\n", str.c_str(), result.arg[0]);
+      failures++;
+      break;
+    }
+  }
+  return failures;
+}
+
+static void dump(const std::string &stream, long offset){
+  long from(offset > 32 ? offset - 32 : 0);
+  for(long i(from); i <= offset; ++i){
+    fprintf(stderr, (isprint((unsigned char)stream[i]) ? "%c" : "\\x%02X"), (unsigned char)stream[i]);
+  }
+  fprintf(stderr, " <-- offset %ld\n", offset);
+}
+
+int main(int argc, char *argv[]){
+  double mbytes(16);
+  unsigned streams(10000);
+  std::vector<corpus_t> corpora;
+  for(int i(1); i < argc; ++i){
+    if((strcmp(argv[i], "-m") == 0) && (i + 1 < argc)){
+      mbytes = atof(argv[++i]);
+    }else if((strcmp(argv[i], "-f") == 0) && (i + 1 < argc)){
+      streams = (unsigned)strtoul(argv[++i], NULL, 0);
+    }else if((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)){
+      rand_seed = (unsigned)strtoul(argv[++i], NULL, 0);
+      if(rand_seed == 0){rand_seed = 1;}
+    }else{
+      corpus_t c;
+      if(!read_corpus(argv[i], c)){
+        fprintf(stderr, "cannot open %s\n", argv[i]);
+        return 1;
+      }
+      corpora.push_back(c);
+    }
+  }
+  unsigned seed(rand_seed);
+  {
+    std::vector<corpus_t> built_in(built_in_corpora());
+    corpora.insert(corpora.begin(), built_in.begin(), built_in.end());
+  }
+
+  int failures(0);
+  for(unsigned i(0); i < corpora.size(); ++i){
+    const std::string &stream(corpora[i].stream);
+    if(stream.empty()){continue;}
+
+    // the first pass is checked
+    parser_reset();
+    memset(&result, 0, sizeof(result));
+    long offset(parse_checked(stream));
+    if(offset >= 0){
+      fprintf(stderr, "%s: %s\n", corpora[i].name.c_str(), result.error);
+      dump(stream, offset);
+      failures++;
+      continue;
+    }
+
+    unsigned passes((unsigned)(mbytes * 1E6 / stream.size()) + 1);
+    memset(&result, 0, sizeof(result));
+    double start(now_sec());
+    for(unsigned j(0); j < passes; ++j){
+      for(unsigned k(0); k < stream.size(); ++k){parse(stream[k]);}
+    }
+    double wall(now_sec() - start);
+    printf("%-12s %10lu bytes, %8.1f MB/s, %10.0f commands/s, %10.0f data bytes/s\n",
+        corpora[i].name.c_str(), (unsigned long)stream.size() * passes,
+        1E-6 * stream.size() * passes / wall, result.commands / wall, result.talks / wall);
+  }
+
+  failures += check_args(streams * 10);
+
+  // fuzz
+  unsigned long bytes(0);
+  for(unsigned i(0); i < streams; ++i){
+    std::string stream(random_stream(16 + (next_rand() % 256)));
+    parser_reset();
+    memset(&result, 0, sizeof(result));
+    long offset(parse_checked(stream));
+    bytes += stream.size();
+    if(offset >= 0){
+      fprintf(stderr, "fuzz (seed %u, stream %u): %s\n", seed, i, result.error);
+      dump(stream, offset);
+      failures++;
+      break;
+    }
+  }
+  printf("fuzz         %10lu bytes in %u streams (seed %u)\n", bytes, streams, seed);
+
+  printf("%s (%d failure(s))\n", failures ? "FAILED" : "PASSED", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,596 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Arbitration daemon; it owns one adapter and serves several clients
+ * (logger, GUI, automated test, ...) over a Unix domain socket.
+ *
+ * usage: gpibd [-s socket] [-n batch] tty
+ *   -s socket  path of the socket (default /tmp/gpibd.sock)
+ *   -n batch   maximum transactions written at once (default 16)
+ *
+ * Clients speak the same protocol as the adapter (ESC escape, "++" commands
+ * at the beginning of a line, CR/LF terminators), for example with
+ * "socat - UNIX-CONNECT:/tmp/gpibd.sock". Each client has its own
+ * ++addr, ++auto, ++eos, ++eoi, ++eot_enable, ++eot_char and ++read_tmo_ms,
+ * which are kept in the daemon and sent to the adapter only when they differ
+ * from the adapter's current ones at the time of a transaction.
+ * Reads, including ++auto 1, are performed as tagged transactions (++tx),
+ * so that they need no ++addr and every read has exactly one reply,
+ * which is framed by LF (CR under ++eos 1), or by the length of an IEEE 488.2 binary block.
+ *
+ * "++prio [n]" (daemon only) sets the priority of the client (default 0);
+ * pending transactions of higher priority clients are issued first,
+ * and clients of the same priority are served in turn.
+ * Commands affecting all clients (++rst, ++mode n, ++tx, ++sched, ...) are ignored.
+ *
+ * Statistics are printed to stderr at exit (SIGINT/SIGTERM).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+#include <sstream>
+
+#include "lib/gpib_adapter.h"
+
+using gpib_usb::Adapter;
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int){quit = 1;}
+
+// Settings which are kept per client; negative or empty is unknown.
+struct settings_t {
+  std::string addr;
+  int eos, eoi, eot_enable, eot_char, read_tmo_ms;
+};
+
+enum {
+  NEED_ADDR = 0x01,
+  NEED_EOS = 0x02,
+  NEED_EOI = 0x04,
+  NEED_EOT = 0x08,
+  NEED_TMO = 0x10,
+};
+
+struct transaction_t {
+  enum kind_t {
+    WRITE, // data without read
+    QUERY, // data with read (++auto 1)
+    READ, // ++read
+    COMMAND, // forwarded command without reply
+    COMMAND_REPLY, // forwarded command with one line reply
+    LOCAL_REPLY, // reply by the daemon, kept in order with the others
+  } kind;
+  unsigned need; // NEED_*
+  std::string data; // unescaped data, command without "++", or local reply
+  settings_t settings; // of the client at the time of reception
+};
+
+struct client_t {
+  int fd;
+  uint64_t id, served;
+  int prio;
+  bool auto_read;
+  settings_t settings;
+  std::string line, out;
+  unsigned line_plus; // unescaped '+' at the beginning of the line
+  bool escaped, last_cr;
+  std::deque<transaction_t> pending;
+};
+
+static std::map<uint64_t, client_t *> clients;
+
+static struct {
+  uint64_t transactions, batches, settings_sent, settings_elided, timeouts;
+} stats;
+
+static const char *terminator(int eos){ // same as the firmware
+  switch(eos){
+    case 0: return "\r\n";
+    case 1: return "\r";
+    default: return "\n";
+  }
+}
+
+static void send_to(client_t *client, const std::string &str){
+  client->out += str;
+  while(!client->out.empty()){
+    ssize_t n(::send(client->fd, client->out.data(), client->out.size(), MSG_NOSIGNAL | MSG_DONTWAIT));
+    if(n < 0){
+      if(errno == EINTR){continue;}
+      break; // EAGAIN, or error to be detected by recv()
+    }
+    client->out.erase(0, n);
+  }
+}
+
+static void reply(client_t *client, const std::string &str){
+  transaction_t t;
+  t.kind = transaction_t::LOCAL_REPLY;
+  t.need = 0;
+  t.data = str + terminator(client->settings.eos);
+  client->pending.push_back(t);
+}
+
+static void reply_number(client_t *client, int v){
+  std::ostringstream ss;
+  ss << v;
+  reply(client, ss.str());
+}
+
+// Update an integer setting like renew_arg0_u8/u16 of the firmware
+static bool renew(const std::vector<std::string> &args, int &v, int max){
+  if(args.size() < 2){return false;}
+  char *end;
+  long l(strtol(args[1].c_str(), &end, 0));
+  if((*end != '\0') || (l < 0) || (l > max)){return false;}
+  v = (int)l;
+  return true;
+}
+
+static void command(client_t *client, const std::string &str){
+  std::vector<std::string> args;
+  {
+    std::istringstream ss(str);
+    std::string s;
+    while(ss >> s){args.push_back(s);}
+  }
+  if(args.empty()){return;}
+  const std::string &cmd(args[0]);
+  settings_t &settings(client->settings);
+
+  // per client settings
+  if(cmd == "addr"){
+    if(args.size() > 1){
+      std::string addr;
+      for(size_t i(1); i < args.size(); ++i){
+        if(i > 1){addr += ' ';}
+        addr += args[i];
+      }
+      settings.addr = addr;
+      return;
+    }
+    reply(client, settings.addr);
+    return;
+  }
+  struct {const char *name; int *v; int max;} items[] = {
+    {"eos", &settings.eos, 3},
+    {"eoi", &settings.eoi, 1},
+    {"eot_enable", &settings.eot_enable, 1},
+    {"eot_char", &settings.eot_char, 255},
+    {"read_tmo_ms", &settings.read_tmo_ms, 3000},
+    {"prio", &client->prio, 255},
+  };
+  for(size_t i(0); i < sizeof(items) / sizeof(items[0]); ++i){
+    if(cmd != items[i].name){continue;}
+    if(!renew(args, *items[i].v, items[i].max) && (args.size() < 2)){
+      reply_number(client, *items[i].v);
+    }
+    return;
+  }
+  if(cmd == "auto"){
+    int v(client->auto_read ? 1 : 0);
+    if(renew(args, v, 1)){
+      client->auto_read = (v > 0);
+    }else if(args.size() < 2){
+      reply_number(client, v);
+    }
+    return;
+  }
+
+  // forwarded to the adapter
+  transaction_t t;
+  t.kind = transaction_t::COMMAND;
+  t.need = 0;
+  t.data = str;
+  t.settings = settings;
+  if(cmd == "read"){
+    t.kind = transaction_t::READ;
+    t.need = NEED_EOT | NEED_TMO;
+    t.data.clear();
+  }else if((cmd == "clr") || (cmd == "llo") || (cmd == "loc")){
+    if(args.size() < 2){t.need = NEED_ADDR;}
+  }else if(cmd == "trg"){
+    for(size_t i(1); i < args.size(); ++i){
+      if((args[i] == "ts") || (args[i] == "read")){return;} // replies not supported
+    }
+    if(args.size() < 2){t.need = NEED_ADDR;}
+  }else if(cmd == "spoll"){
+    t.kind = transaction_t::COMMAND_REPLY;
+    if(args.size() < 2){t.need = NEED_ADDR;}
+  }else if((cmd == "ver") || (cmd == "srq") || (cmd == "stats")){
+    t.kind = transaction_t::COMMAND_REPLY;
+  }else if((cmd == "mode") || (cmd == "lon") || (cmd == "status") || (cmd == "tstamp")){
+    if(args.size() > 1){return;} // queries only
+    t.kind = transaction_t::COMMAND_REPLY;
+  }else if((cmd == "ifc") || (cmd == "savecfg")){
+    t.need = (cmd == "savecfg") ? (NEED_ADDR | NEED_EOS | NEED_EOI | NEED_EOT | NEED_TMO) : 0;
+  }else{
+    fprintf(stderr, "client %llu: ++%s ignored\n", (unsigned long long)client->id, cmd.c_str());
+    return;
+  }
+  client->pending.push_back(t);
+}
+
+static void data(client_t *client, const std::string &str){
+  if(str.empty()){return;} // the firmware also ignores an empty line
+  transaction_t t;
+  t.data = str;
+  t.settings = client->settings;
+  if(client->auto_read){
+    t.kind = transaction_t::QUERY;
+    t.need = NEED_EOS | NEED_EOI | NEED_EOT | NEED_TMO;
+  }else{
+    t.kind = transaction_t::WRITE;
+    t.need = NEED_ADDR | NEED_EOS | NEED_EOI;
+  }
+  client->pending.push_back(t);
+}
+
+// Split the input into lines in the same way as the firmware parser
+static void receive(client_t *client, const char *buf, size_t size){
+  for(size_t i(0); i < size; ++i){
+    char c(buf[i]);
+    bool cr(false);
+    if(client->escaped){
+      client->escaped = false;
+    }else{
+      switch(c){
+        case 0x1B:
+          client->escaped = true;
+          client->last_cr = false;
+          continue;
+        case '+':
+          if(client->line.size() == client->line_plus){client->line_plus++;}
+          break;
+        case '\n':
+          if(client->last_cr){
+            client->last_cr = false;
+            continue;
+          }
+        case '\r':
+          cr = (c == '\r');
+          if(client->line_plus >= 2){
+            command(client, client->line.substr(client->line_plus));
+          }else{
+            data(client, client->line);
+          }
+          client->line.clear();
+          client->line_plus = 0;
+          client->last_cr = cr;
+          continue;
+      }
+    }
+    client->last_cr = false;
+    client->line += c;
+  }
+}
+
+class Arbiter {
+  Adapter &adapter;
+  settings_t current; // of the adapter
+  unsigned batch_max;
+  uint16_t tag;
+
+  void set(const char *name, int &now, int v){
+    if(now == v){
+      stats.settings_elided++;
+      return;
+    }
+    std::ostringstream ss;
+    ss << name << ' ' << v;
+    adapter.command(ss.str());
+    now = v;
+    stats.settings_sent++;
+  }
+  void apply(const settings_t &settings, unsigned need){
+    if(need & NEED_ADDR){
+      if(current.addr == settings.addr){
+        stats.settings_elided++;
+      }else{
+        adapter.command("addr " + settings.addr);
+        current.addr = settings.addr;
+        stats.settings_sent++;
+      }
+    }
+    if(need & NEED_EOS){set("eos", current.eos, settings.eos);}
+    if(need & NEED_EOI){set("eoi", current.eoi, settings.eoi);}
+    if(need & NEED_EOT){
+      set("eot_enable", current.eot_enable, settings.eot_enable);
+      if(settings.eot_enable){set("eot_char", current.eot_char, settings.eot_char);}
+    }
+    if(need & NEED_TMO){set("read_tmo_ms", current.read_tmo_ms, settings.read_tmo_ms);}
+  }
+
+  // Pick the client to be served next; the highest priority, then the least recently served
+  client_t *next(){
+    client_t *res(NULL);
+    for(std::map<uint64_t, client_t *>::iterator it(clients.begin()); it != clients.end(); ++it){
+      client_t *c(it->second);
+      if(c->pending.empty()){continue;}
+      if(!res || (c->prio > res->prio)
+          || ((c->prio == res->prio) && (c->served < res->served))){
+        res = c;
+      }
+    }
+    return res;
+  }
+
+public:
+  uint64_t served;
+
+  Arbiter(Adapter &adapter_, unsigned batch_max_)
+      : adapter(adapter_), current(), batch_max(batch_max_), tag(0), served(0) {
+    current.eos = current.eoi = current.eot_enable = current.eot_char = current.read_tmo_ms = -1;
+  }
+
+  settings_t initial(){
+    adapter.command("auto 0");
+    adapter.command("debug 0");
+    adapter.command("eos 0"); // for replies terminated by LF
+    current.eos = 0;
+    if(adapter.wait(adapter.submit_command("mode")).compare(0, 1, "1") != 0){
+      throw gpib_usb::Error("adapter is not in controller mode");
+    }
+    current.addr = adapter.wait(adapter.submit_command("addr"));
+    current.addr.erase(current.addr.find_last_not_of("\r\n") + 1);
+    struct {const char *name; int *v;} items[] = {
+      {"eoi", &current.eoi},
+      {"eot_enable", &current.eot_enable},
+      {"eot_char", &current.eot_char},
+      {"read_tmo_ms", &current.read_tmo_ms},
+    };
+    for(size_t i(0); i < sizeof(items) / sizeof(items[0]); ++i){
+      *items[i].v = atoi(adapter.wait(adapter.submit_command(items[i].name)).c_str());
+    }
+    return current;
+  }
+
+  bool pending(){return next() != NULL;}
+
+  // Issue a batch of the pending transactions at once, then deliver the replies.
+  void run(){
+    struct issued_t {
+      uint64_t client_id, ticket;
+      transaction_t::kind_t kind;
+      uint16_t tag;
+      int eos, timeout_ms;
+    };
+    std::vector<issued_t> issued;
+    std::vector<std::string> local;
+    unsigned i(0);
+    for(; i < batch_max; ++i){
+      client_t *client(next());
+      if(!client){break;}
+      transaction_t t(client->pending.front());
+      client->pending.pop_front();
+      client->served = ++served;
+      stats.transactions++;
+
+      apply(t.settings, t.need);
+      issued_t item = {client->id, 0, t.kind, 0, t.settings.eos, 3000};
+      switch(t.kind){
+        case transaction_t::WRITE:
+          adapter.write(t.data);
+          continue;
+        case transaction_t::COMMAND:
+          adapter.command(t.data);
+          continue;
+        case transaction_t::QUERY:
+        case transaction_t::READ: {
+          std::ostringstream ss;
+          tag = (tag + 1) & 0x7FFF; // positive in 16-bit int, as Adapter::submit() does
+          item.tag = tag;
+          ss << "tx " << item.tag << ' ' << t.settings.addr;
+          item.ticket = adapter.submit_command(ss.str(), // ++eos 1 ends the read at CR
+              (t.settings.eos == 1) ? Adapter::FRAME_LINE_CR : Adapter::FRAME_TX);
+          adapter.write(t.data); // an empty line is a read only transaction
+          item.timeout_ms += t.settings.read_tmo_ms;
+          break;
+        }
+        case transaction_t::COMMAND_REPLY:
+          if(current.eos == 1){set("eos", current.eos, 0);} // reply terminated by CR only
+          item.ticket = adapter.submit_command(t.data);
+          break;
+        case transaction_t::LOCAL_REPLY:
+          local.push_back(t.data);
+          item.ticket = local.size() - 1;
+          break;
+      }
+      issued.push_back(item);
+    }
+    if(i == 0){return;}
+    adapter.flush();
+    stats.batches++;
+
+    bool failed(false);
+    for(std::vector<issued_t>::iterator it(issued.begin()); it != issued.end(); ++it){
+      std::string reply;
+      switch(it->kind){
+        case transaction_t::LOCAL_REPLY:
+          reply = local[it->ticket];
+          break;
+        default:
+          if(!failed){
+            try{
+              reply = adapter.wait(it->ticket, it->timeout_ms);
+            }catch(gpib_usb::Error &e){
+              fprintf(stderr, "client %llu: %s\n", (unsigned long long)it->client_id, e.what());
+              stats.timeouts++;
+              failed = true; // the following replies are also lost
+            }
+          }
+          if(failed){
+            reply = terminator(it->eos); // one reply per request even if lost, as the firmware does
+          }else if(it->kind == transaction_t::COMMAND_REPLY){
+            reply.erase(reply.find_last_not_of("\r\n") + 1);
+            reply += terminator(it->eos);
+          }else{ // "<tag> <data>"
+            std::ostringstream ss;
+            ss << it->tag << ' ';
+            if(reply.compare(0, ss.str().size(), ss.str()) == 0){
+              reply.erase(0, ss.str().size());
+            }else{
+              fprintf(stderr, "client %llu: unexpected reply\n", (unsigned long long)it->client_id);
+            }
+          }
+      }
+      std::map<uint64_t, client_t *>::iterator client(clients.find(it->client_id));
+      if(client != clients.end()){send_to(client->second, reply);}
+    }
+    if(failed){adapter.drain(500);} // discard late replies
+  }
+};
+
+int main(int argc, char *argv[]){
+  const char *path("/tmp/gpibd.sock");
+  unsigned batch_max(16);
+  int opt;
+  while((opt = getopt(argc, argv, "s:n:")) != -1){
+    switch(opt){
+      case 's': path = optarg; break;
+      case 'n': batch_max = (unsigned)atoi(optarg); break;
+      default: optind = argc + 1;
+    }
+  }
+  if((optind != argc - 1) || (batch_max == 0)){
+    fprintf(stderr, "usage: %s [-s socket] [-n batch] tty\n", argv[0]);
+    return 2;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  int listen_fd(-1), epfd(-1);
+  try{
+    Adapter adapter(argv[optind]);
+    Arbiter arbiter(adapter, batch_max);
+    settings_t initial(arbiter.initial());
+
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(sa.sun_path)){throw gpib_usb::Error("socket path too long");}
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if((listen_fd < 0)
+        || (bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        || (listen(listen_fd, 16) < 0)){
+      throw gpib_usb::Error(std::string("socket: ") + strerror(errno));
+    }
+    epfd = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0; // listener; clients are 1, 2, ...
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    fprintf(stderr, "listening on %s\n", path);
+
+    uint64_t next_id(1);
+    while(!quit){
+      struct epoll_event evs[16];
+      int timeout_ms(-1);
+      if(arbiter.pending()){
+        timeout_ms = 0;
+      }else{
+        for(std::map<uint64_t, client_t *>::iterator it(clients.begin()); it != clients.end(); ++it){
+          if(!it->second->out.empty()){timeout_ms = 10;} // blocked output is retried
+        }
+      }
+      int n(epoll_wait(epfd, evs, 16, timeout_ms));
+      if(n < 0){
+        if(errno == EINTR){continue;}
+        throw gpib_usb::Error(std::string("epoll_wait: ") + strerror(errno));
+      }
+      for(int i(0); i < n; ++i){
+        if(evs[i].data.u64 == 0){
+          int fd(accept(listen_fd, NULL, NULL));
+          if(fd < 0){continue;}
+          client_t *client(new client_t());
+          client->fd = fd;
+          client->id = next_id++;
+          client->served = arbiter.served;
+          client->settings = initial;
+          ev.events = EPOLLIN;
+          ev.data.u64 = client->id;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+          clients[client->id] = client;
+          continue;
+        }
+        std::map<uint64_t, client_t *>::iterator it(clients.find(evs[i].data.u64));
+        if(it == clients.end()){continue;}
+        client_t *client(it->second);
+        char buf[0x1000];
+        ssize_t len(recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT));
+        if(len > 0){
+          receive(client, buf, len);
+          send_to(client, std::string()); // retry pending output
+        }else if((len == 0) || (errno != EAGAIN && errno != EINTR)){
+          close(client->fd); // also removed from epoll
+          clients.erase(it);
+          delete client;
+        }
+      }
+      arbiter.run();
+      for(std::map<uint64_t, client_t *>::iterator it(clients.begin()); it != clients.end(); ++it){
+        if(!it->second->out.empty()){send_to(it->second, std::string());}
+      }
+    }
+  }catch(gpib_usb::Error &e){
+    fprintf(stderr, "error: %s\n", e.what());
+    if(listen_fd >= 0){unlink(path);}
+    return 1;
+  }
+  unlink(path);
+  for(std::map<uint64_t, client_t *>::iterator it(clients.begin()); it != clients.end(); ++it){
+    close(it->second->fd);
+    delete it->second;
+  }
+  fprintf(stderr, "transactions %llu in %llu batches, settings sent %llu / elided %llu, timeouts %llu\n",
+      (unsigned long long)stats.transactions, (unsigned long long)stats.batches,
+      (unsigned long long)stats.settings_sent, (unsigned long long)stats.settings_elided,
+      (unsigned long long)stats.timeouts);
+  return 0;
+}
@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * HiSLIP (IVI-6.1) server bridging LAN instrument drivers to the adapter,
+ * so that the instruments on its bus are available as
+ * "TCPIP::<host>::gpib0,<pad>[,<sad>]::INSTR" (HiSLIP sub-address "gpib0,<pad>[,<sad>]").
+ *
+ * usage: hislip_bridge [-p port] [-S] [-d pad] [-n batch] tty
+ *   -p port   TCP port (default 4880)
+ *   -S        synchronized mode instead of overlapped mode
+ *   -d pad    device of the sub-address "hislip0" (default 1)
+ *   -n batch  maximum requests written to the adapter at once (default 16)
+ *
+ * HiSLIP has no read request, so a message whose last program message unit
+ * contains '?' is taken as a query; it is performed as a ++tx tagged transaction,
+ * and its reply is returned with the message ID of the query,
+ * which is an empty DATA_END when the device does not answer.
+ * Other messages are written after ++addr, which is sent only when
+ * the address differs from the adapter's current one.
+ * In overlapped mode, requests of all sessions are queued and written
+ * to the adapter in batches without waiting for each reply.
+ *
+ * Statistics are printed to stderr at exit (SIGINT/SIGTERM).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+#include <sstream>
+
+#include "lib/gpib_adapter.h"
+#include "lib/hislip.h"
+
+using gpib_usb::Adapter;
+using namespace hislip;
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int){quit = 1;}
+
+static const uint16_t vendor_id = ('F' << 8) | 'N';
+static const uint64_t max_message_size = 1 << 20;
+
+struct session_t;
+
+struct connection_t {
+  int fd;
+  std::string in, out;
+  session_t *session;
+  bool async, closing;
+};
+
+struct request_t {
+  enum {WRITE, QUERY, TRIGGER} kind;
+  std::string data;
+  uint32_t message_id;
+};
+
+struct session_t {
+  uint16_t id;
+  connection_t *sync, *async;
+  std::string addr; // "pad [sad]"
+  std::string message; // Data not ended yet
+  uint64_t client_max_size;
+  uint64_t served;
+  bool exclusive_lock;
+  std::deque<request_t> pending;
+};
+
+static std::map<uint16_t, session_t *> sessions;
+static std::map<std::string, uint16_t> exclusive_locks; // addr => session ID
+
+static struct {
+  uint64_t messages, queries, batches, addr_sent, addr_elided, timeouts;
+} stats;
+
+static void flush_out(connection_t *conn){
+  while(!conn->out.empty()){
+    ssize_t n(::send(conn->fd, conn->out.data(), conn->out.size(), MSG_NOSIGNAL | MSG_DONTWAIT));
+    if(n < 0){
+      if(errno == EINTR){continue;}
+      break; // EAGAIN, or error to be detected by recv()
+    }
+    conn->out.erase(0, n);
+  }
+}
+
+static void send_message(connection_t *conn,
+    uint8_t type, uint8_t control, uint32_t param, const std::string &payload = std::string()){
+  if(!conn){return;}
+  conn->out += header_t(type, control, param, payload.size()).encode();
+  conn->out += payload;
+  flush_out(conn);
+}
+
+static void send_error(connection_t *conn, bool fatal, uint8_t code, const std::string &msg){
+  fprintf(stderr, "%s error %u: %s\n", fatal ? "fatal" : "non-fatal", code, msg.c_str());
+  send_message(conn, fatal ? FATAL_ERROR : ERROR, code, 0, msg);
+  if(fatal){conn->closing = true;}
+}
+
+// "hislip0" or "gpib0,<pad>[,<sad>]" to "pad [sad]"
+static bool parse_sub_address(const std::string &sub, int default_pad, std::string &addr){
+  std::ostringstream ss;
+  if((sub.empty()) || (sub == "hislip0")){
+    ss << default_pad;
+  }else{
+    int pad, sad(-1);
+    char c;
+    if((sscanf(sub.c_str(), "gpib0,%d%c", &pad, &c) != 1)
+        && ((sscanf(sub.c_str(), "gpib0,%d,%d%c", &pad, &sad, &c) != 2) || (sad < 0) || (sad > 30))){
+      return false;
+    }
+    if((pad < 0) || (pad > 30)){return false;}
+    ss << pad;
+    if(sad >= 0){ss << ' ' << (sad + 96);}
+  }
+  addr = ss.str();
+  return true;
+}
+
+// Whether the message is a query; '?' in its last program message unit
+static bool is_query(const std::string &msg){
+  size_t end(msg.find_last_not_of(" \t\r\n"));
+  if(end == std::string::npos){return false;}
+  size_t start(msg.find_last_of(';', end));
+  start = (start == std::string::npos) ? 0 : (start + 1);
+  return msg.find('?', start) < end + 1;
+}
+
+class Bridge {
+  Adapter &adapter;
+  std::string current_addr; // of the adapter
+  unsigned batch_max;
+  uint16_t tag;
+
+  void apply_addr(const std::string &addr){
+    if(current_addr == addr){
+      stats.addr_elided++;
+      return;
+    }
+    adapter.command("addr " + addr);
+    current_addr = addr;
+    stats.addr_sent++;
+  }
+
+  session_t *next(){
+    session_t *res(NULL);
+    for(std::map<uint16_t, session_t *>::iterator it(sessions.begin()); it != sessions.end(); ++it){
+      session_t *s(it->second);
+      if(s->pending.empty()){continue;}
+      if(!res || (s->served < res->served)){res = s;}
+    }
+    return res;
+  }
+
+public:
+  const bool overlapped;
+  uint64_t served;
+
+  Bridge(Adapter &adapter_, unsigned batch_max_, bool overlapped_)
+      : adapter(adapter_), current_addr(), batch_max(batch_max_), tag(0),
+      overlapped(overlapped_), served(0) {
+    adapter.command("auto 0");
+    adapter.command("debug 0");
+    adapter.command("eos 2"); // LF, the usual terminator of messages on LAN
+    adapter.command("eoi 1");
+    if(adapter.wait(adapter.submit_command("mode")).compare(0, 1, "1") != 0){
+      throw gpib_usb::Error("adapter is not in controller mode");
+    }
+  }
+
+  bool pending(){return next() != NULL;}
+
+  // Status byte by serial poll, for AsyncStatusQuery
+  uint8_t status(const std::string &addr){
+    try{
+      return (uint8_t)atoi(adapter.wait(adapter.submit_command("spoll " + addr)).c_str());
+    }catch(gpib_usb::Error &e){
+      stats.timeouts++;
+      adapter.drain(500);
+      return 0;
+    }
+  }
+
+  void command(const std::string &cmd, const std::string &addr){
+    apply_addr(addr);
+    adapter.command(cmd);
+    adapter.flush();
+  }
+
+  /*
+   * Write a batch of the pending requests, then send the replies.
+   * In synchronized mode, a batch ends with the first query.
+   */
+  void run(){
+    struct issued_t {
+      uint16_t session_id, tag;
+      uint32_t message_id;
+      uint64_t ticket;
+      int timeout_ms;
+    };
+    std::vector<issued_t> issued;
+    unsigned i(0);
+    while(i < batch_max){
+      session_t *s(next());
+      if(!s){break;}
+      request_t r(s->pending.front());
+      s->pending.pop_front();
+      s->served = ++served;
+      i++;
+
+      switch(r.kind){
+        case request_t::WRITE:
+          apply_addr(s->addr);
+          adapter.write(r.data);
+          break;
+        case request_t::TRIGGER:
+          adapter.command("trg " + s->addr);
+          break;
+        case request_t::QUERY: {
+          std::ostringstream ss;
+          tag = (tag + 1) & 0x7FFF; // positive in 16-bit int, as Adapter::submit() does
+          issued_t item = {s->id, tag, r.message_id, 0, 3000};
+          ss << "tx " << item.tag << ' ' << s->addr;
+          item.ticket = adapter.submit_command(ss.str(), Adapter::FRAME_TX);
+          adapter.write(r.data);
+          issued.push_back(item);
+          stats.queries++;
+          break;
+        }
+      }
+      if(!overlapped && !issued.empty()){break;}
+    }
+    if(i == 0){return;}
+    adapter.flush();
+    stats.batches++;
+
+    bool failed(false);
+    for(std::vector<issued_t>::iterator it(issued.begin()); it != issued.end(); ++it){
+      std::string reply;
+      if(!failed){
+        try{
+          reply = adapter.wait(it->ticket, it->timeout_ms);
+        }catch(gpib_usb::Error &e){
+          fprintf(stderr, "session %u: %s\n", it->session_id, e.what());
+          stats.timeouts++;
+          failed = true; // the following replies are also lost
+        }
+      }
+      if(!failed){
+        std::ostringstream ss;
+        ss << it->tag << ' ';
+        if(reply.compare(0, ss.str().size(), ss.str()) != 0){
+          fprintf(stderr, "session %u: unexpected reply\n", it->session_id);
+          reply.clear();
+        }else{
+          reply.erase(0, ss.str().size());
+          if(reply == "\n"){ // read timeout of the adapter
+            stats.timeouts++;
+            reply.clear();
+          }
+        }
+      }
+      std::map<uint16_t, session_t *>::iterator s(sessions.find(it->session_id));
+      if(s == sessions.end()){continue;}
+      connection_t *conn(s->second->sync);
+      size_t chunk(s->second->client_max_size), pos(0);
+      do{ // a lost reply is an empty DATA_END, so that the client need not wait for its timeout
+        bool end(reply.size() - pos <= chunk);
+        send_message(conn, end ? DATA_END : DATA, 0, it->message_id, reply.substr(pos, chunk));
+        pos += chunk;
+      }while(pos < reply.size());
+    }
+    if(failed){adapter.drain(500);} // discard late replies
+  }
+};
+
+static void close_session(session_t *s){
+  for(std::map<std::string, uint16_t>::iterator it(exclusive_locks.begin()); it != exclusive_locks.end(); ){
+    if(it->second == s->id){
+      exclusive_locks.erase(it++);
+    }else{
+      ++it;
+    }
+  }
+  if(s->async){s->async->closing = true; s->async->session = NULL;}
+  if(s->sync){s->sync->closing = true; s->sync->session = NULL;}
+  sessions.erase(s->id);
+  delete s;
+}
+
+static void on_message(Bridge &bridge, connection_t *conn,
+    const header_t &h, const std::string &payload, int default_pad){
+  static uint16_t next_session_id(1);
+  session_t *s(conn->session);
+  stats.messages++;
+
+  if(!s){ // initialization
+    if(h.type == INITIALIZE){
+      s = new session_t();
+      if(!parse_sub_address(payload, default_pad, s->addr)){
+        delete s;
+        send_error(conn, true, FATAL_INVALID_INIT, "unknown sub-address " + payload);
+        return;
+      }
+      while(sessions.find(next_session_id) != sessions.end()){next_session_id++;}
+      s->id = next_session_id++;
+      s->sync = conn;
+      s->client_max_size = max_message_size;
+      sessions[s->id] = s;
+      conn->session = s;
+      send_message(conn, INITIALIZE_RESPONSE, bridge.overlapped ? 1 : 0,
+          (PROTOCOL_VERSION << 16) | s->id);
+    }else if(h.type == ASYNC_INITIALIZE){
+      std::map<uint16_t, session_t *>::iterator it(sessions.find((uint16_t)h.param));
+      if((it == sessions.end()) || it->second->async){
+        send_error(conn, true, FATAL_INVALID_INIT, "unknown session ID");
+        return;
+      }
+      s = it->second;
+      s->async = conn;
+      conn->session = s;
+      conn->async = true;
+      send_message(conn, ASYNC_INITIALIZE_RESPONSE, 0, vendor_id);
+    }else{
+      send_error(conn, true, FATAL_NOT_INITIALIZED, "not initialized");
+    }
+    return;
+  }
+
+  switch(h.type){
+    case DATA:
+    case DATA_END:
+      s->message += payload;
+      if(h.type == DATA){break;}
+      {
+        request_t r;
+        r.kind = is_query(s->message) ? request_t::QUERY : request_t::WRITE;
+        r.data.swap(s->message);
+        r.data.erase(r.data.find_last_not_of("\r\n") + 1); // the adapter appends LF
+        r.message_id = h.param;
+        s->pending.push_back(r);
+      }
+      break;
+    case TRIGGER: {
+      request_t r = {request_t::TRIGGER, std::string(), h.param};
+      s->pending.push_back(r);
+      break;
+    }
+    case DEVICE_CLEAR_COMPLETE:
+      send_message(conn, DEVICE_CLEAR_ACKNOWLEDGE, bridge.overlapped ? 1 : 0, 0);
+      break;
+    case ASYNC_MAXIMUM_MESSAGE_SIZE:
+      if(payload.size() >= 8){
+        s->client_max_size = decode_u64(payload.data());
+        if(s->client_max_size == 0){s->client_max_size = max_message_size;}
+      }
+      send_message(conn, ASYNC_MAXIMUM_MESSAGE_SIZE_RESPONSE, 0, 0, encode_u64(max_message_size));
+      break;
+    case ASYNC_DEVICE_CLEAR:
+      s->pending.clear();
+      s->message.clear();
+      bridge.command("clr", s->addr);
+      send_message(conn, ASYNC_DEVICE_CLEAR_ACKNOWLEDGE, bridge.overlapped ? 1 : 0, 0);
+      break;
+    case ASYNC_STATUS_QUERY:
+      send_message(conn, ASYNC_STATUS_RESPONSE, bridge.status(s->addr), 0);
+      break;
+    case ASYNC_REMOTE_LOCAL_CONTROL:
+      switch(h.control){
+        case 0: case 2: case 6: bridge.command("loc", s->addr); break; // to local
+        case 4: case 5: bridge.command("llo", s->addr); break; // lockout
+      }
+      send_message(conn, ASYNC_REMOTE_LOCAL_RESPONSE, 0, 0);
+      break;
+    case ASYNC_LOCK:
+      if(h.control == 1){ // request; shared locks are always granted
+        bool granted(true);
+        if(payload.empty()){
+          std::map<std::string, uint16_t>::iterator it(exclusive_locks.find(s->addr));
+          if((it != exclusive_locks.end()) && (it->second != s->id)){
+            granted = false;
+          }else{
+            exclusive_locks[s->addr] = s->id;
+            s->exclusive_lock = true;
+          }
+        }
+        send_message(conn, ASYNC_LOCK_RESPONSE, granted ? 1 : 0, 0);
+      }else{ // release
+        uint8_t res(2); // shared
+        if(s->exclusive_lock){
+          exclusive_locks.erase(s->addr);
+          s->exclusive_lock = false;
+          res = 1;
+        }
+        send_message(conn, ASYNC_LOCK_RESPONSE, res, 0);
+      }
+      break;
+    case ASYNC_LOCK_INFO:
+      send_message(conn, ASYNC_LOCK_INFO_RESPONSE,
+          (exclusive_locks.find(s->addr) != exclusive_locks.end()) ? 1 : 0, 0);
+      break;
+    default:
+      send_error(conn, false, ERROR_UNRECOGNIZED_TYPE, "unrecognized message type");
+      break;
+  }
+}
+
+// Split the received bytes into messages
+static void receive(Bridge &bridge, connection_t *conn, int default_pad){
+  while(!conn->closing && (conn->in.size() >= header_t::size)){
+    header_t h;
+    if(!h.decode(conn->in.data())){
+      send_error(conn, true, FATAL_POORLY_FORMED_HEADER, "poorly formed message header");
+      return;
+    }
+    if(h.length > max_message_size){
+      send_error(conn, true, FATAL_POORLY_FORMED_HEADER, "message too long");
+      return;
+    }
+    if(conn->in.size() < header_t::size + h.length){break;}
+    std::string payload(conn->in.substr(header_t::size, h.length));
+    conn->in.erase(0, header_t::size + h.length);
+    on_message(bridge, conn, h, payload, default_pad);
+  }
+}
+
+int main(int argc, char *argv[]){
+  int port(4880), default_pad(1);
+  unsigned batch_max(16);
+  bool overlapped(true);
+  int opt;
+  while((opt = getopt(argc, argv, "p:Sd:n:")) != -1){
+    switch(opt){
+      case 'p': port = atoi(optarg); break;
+      case 'S': overlapped = false; break;
+      case 'd': default_pad = atoi(optarg); break;
+      case 'n': batch_max = (unsigned)atoi(optarg); break;
+      default: optind = argc + 1;
+    }
+  }
+  if((optind != argc - 1) || (batch_max == 0)){
+    fprintf(stderr, "usage: %s [-p port] [-S] [-d pad] [-n batch] tty\n", argv[0]);
+    return 2;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::map<int, connection_t *> connections;
+  try{
+    Adapter adapter(argv[optind]);
+    Bridge bridge(adapter, batch_max, overlapped);
+
+    int listen_fd(socket(AF_INET, SOCK_STREAM, 0)), one(1);
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(port);
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if((listen_fd < 0)
+        || (bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        || (listen(listen_fd, 16) < 0)){
+      throw gpib_usb::Error(std::string("socket: ") + strerror(errno));
+    }
+    int epfd(epoll_create1(0));
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    fprintf(stderr, "listening on port %d (%s mode)\n", port, overlapped ? "overlapped" : "synchronized");
+
+    while(!quit){
+      struct epoll_event evs[16];
+      int timeout_ms(-1);
+      if(bridge.pending()){
+        timeout_ms = 0;
+      }else{
+        for(std::map<int, connection_t *>::iterator it(connections.begin()); it != connections.end(); ++it){
+          if(!it->second->out.empty()){timeout_ms = 10;} // blocked output is retried
+        }
+      }
+      int n(epoll_wait(epfd, evs, 16, timeout_ms));
+      if(n < 0){
+        if(errno == EINTR){continue;}
+        throw gpib_usb::Error(std::string("epoll_wait: ") + strerror(errno));
+      }
+      for(int i(0); i < n; ++i){
+        if(evs[i].data.fd == listen_fd){
+          int fd(accept(listen_fd, NULL, NULL));
+          if(fd < 0){continue;}
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          connection_t *conn(new connection_t());
+          conn->fd = fd;
+          ev.events = EPOLLIN;
+          ev.data.fd = fd;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+          connections[fd] = conn;
+          continue;
+        }
+        std::map<int, connection_t *>::iterator it(connections.find(evs[i].data.fd));
+        if(it == connections.end()){continue;}
+        connection_t *conn(it->second);
+        char buf[0x10000];
+        ssize_t len(recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT));
+        if(len > 0){
+          conn->in.append(buf, len);
+          receive(bridge, conn, default_pad);
+          flush_out(conn);
+        }else if((len == 0) || (errno != EAGAIN && errno != EINTR)){
+          conn->closing = true;
+        }
+      }
+      bridge.run();
+      for(std::map<int, connection_t *>::iterator it(connections.begin()); it != connections.end(); ++it){
+        connection_t *conn(it->second);
+        if(!conn->out.empty()){flush_out(conn);}
+        if(!conn->closing || !conn->session){continue;}
+        if(conn->async){
+          conn->session->async = NULL;
+          conn->session = NULL;
+        }else{
+          close_session(conn->session); // closing the async channel too
+        }
+      }
+      for(std::map<int, connection_t *>::iterator it(connections.begin()); it != connections.end(); ){
+        connection_t *conn(it->second);
+        if(!conn->closing){
+          ++it;
+          continue;
+        }
+        close(conn->fd); // also removed from epoll
+        connections.erase(it++);
+        delete conn;
+      }
+    }
+  }catch(gpib_usb::Error &e){
+    fprintf(stderr, "error: %s\n", e.what());
+    return 1;
+  }
+  fprintf(stderr, "messages %llu, queries %llu in %llu batches, ++addr sent %llu / elided %llu, timeouts %llu\n",
+      (unsigned long long)stats.messages, (unsigned long long)stats.queries,
+      (unsigned long long)stats.batches, (unsigned long long)stats.addr_sent,
+      (unsigned long long)stats.addr_elided, (unsigned long long)stats.timeouts);
+  return 0;
+}
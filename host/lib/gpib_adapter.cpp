@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "gpib_adapter.h"
+
+namespace gpib_usb {
+
+static std::string errno_str(const std::string &what){
+  return what + ": " + strerror(errno);
+}
+
+Adapter::Adapter(const std::string &path)
+    : writes(0), reads(0), bytes_written(0), bytes_read(0),
+    fd(-1), epfd(-1), want_write(false),
+    out(), in(), next_ticket(0), pendings(), replies() {
+  fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(fd < 0){throw Error(errno_str(path));}
+  struct termios tio;
+  if(tcgetattr(fd, &tio) == 0){ // raw; baudrate is meaningless for USB CDC
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  epfd = epoll_create1(0);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if((epfd < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)){
+    int e(errno);
+    close(fd);
+    if(epfd >= 0){close(epfd);}
+    errno = e;
+    throw Error(errno_str("epoll"));
+  }
+}
+
+Adapter::~Adapter(){
+  try{
+    flush();
+  }catch(Error &){}
+  close(epfd);
+  close(fd);
+}
+
+std::string Adapter::escape(const std::string &data){
+  std::string res;
+  res.reserve(data.size() + (data.size() >> 3));
+  for(std::string::const_iterator it(data.begin()); it != data.end(); ++it){
+    switch(*it){
+      case '+': case '\r': case '\n': case 0x1B:
+        res += (char)0x1B;
+    }
+    res += *it;
+  }
+  return res;
+}
+
+void Adapter::queue(const std::string &str){
+  out += str;
+  if(out.size() >= chunk_size){try_write(false);}
+}
+
+void Adapter::command(const std::string &cmd){
+  queue("++" + cmd + "\n");
+}
+
+void Adapter::write(const std::string &data){
+  queue(escape(data) + "\n");
+}
+
+uint64_t Adapter::expect(framing_t framing, int tag){
+  pending_t pending = {next_ticket, framing, tag};
+  pendings.push_back(pending);
+  return next_ticket++;
+}
+
+bool Adapter::is_pending(uint64_t ticket) const {
+  for(std::deque<pending_t>::const_iterator it(pendings.begin()); it != pendings.end(); ++it){
+    if(it->ticket == ticket){return true;}
+  }
+  return false;
+}
+
+uint64_t Adapter::submit(int pad, const std::string &query, framing_t framing){
+  int tag((int)(next_ticket & 0x7FFF)); // ++tx accepts 0-32767
+  char buf[32];
+  snprintf(buf, sizeof(buf), "++tx %d %d\n", tag, pad);
+  queue(buf + escape(query) + "\n"); // an empty query is a read only transaction
+  return expect((framing == FRAME_TX) ? FRAME_BLOCK : framing, tag);
+}
+
+uint64_t Adapter::submit_command(const std::string &cmd, framing_t framing){
+  queue("++" + cmd + "\n");
+  return expect(framing);
+}
+
+void Adapter::try_write(bool all){
+  while(!out.empty()){
+    size_t size(all ? out.size() : (out.size() / chunk_size * chunk_size));
+    if(size == 0){break;}
+    ssize_t n(::write(fd, out.data(), size));
+    if(n < 0){
+      if(errno == EAGAIN){break;}
+      if(errno == EINTR){continue;}
+      throw Error(errno_str("write"));
+    }
+    writes++;
+    bytes_written += n;
+    out.erase(0, n);
+  }
+  bool need(!out.empty());
+  if(need != want_write){ // wait for POLLOUT only while blocked
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (need ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    want_write = need;
+  }
+}
+
+void Adapter::flush(){
+  try_write(true);
+  while(want_write){pump(true, -1);}
+}
+
+void Adapter::try_read(){
+  char buf[0x10000];
+  while(true){
+    ssize_t n(::read(fd, buf, sizeof(buf)));
+    if(n < 0){
+      if(errno == EAGAIN){break;}
+      if(errno == EINTR){continue;}
+      throw Error(errno_str("read"));
+    }
+    if(n == 0){throw Error("closed");}
+    reads++;
+    bytes_read += n;
+    in.append(buf, n);
+    if((size_t)n < sizeof(buf)){break;}
+  }
+  split_replies();
+}
+
+void Adapter::split_replies(){
+  size_t pos(0);
+  while(!pendings.empty() && (pos < in.size())){
+    std::deque<pending_t>::iterator it(pendings.begin());
+    size_t head(pos), end(std::string::npos);
+    if(it->tag >= 0){ // "<tag> " of ++tx
+      size_t sp(in.find(' ', pos)), lf(in.find((it->framing == FRAME_LINE_CR) ? '\r' : '\n', pos));
+      if((sp == std::string::npos) || (lf < sp)){
+        if(lf == std::string::npos){break;}
+        pos = lf + 1; // not a reply of ++tx, skipped
+        continue;
+      }
+      const char *digits(in.data() + pos);
+      char *digits_end;
+      long tag(strtol(digits, &digits_end, 10));
+      if((digits_end == digits) || (digits_end != in.data() + sp)){tag = -1;}
+      while((it != pendings.end()) && (it->tag != tag)){++it;}
+      if(it == pendings.end()){
+        if(lf == std::string::npos){break;}
+        pos = lf + 1; // unknown tag, skipped
+        continue;
+      }
+      head = sp + 1;
+    }
+    switch(it->framing){
+      case FRAME_LINE:
+      case FRAME_LINE_CR: {
+        const char *lf((const char *)memchr(in.data() + head,
+            (it->framing == FRAME_LINE) ? '\n' : '\r', in.size() - head));
+        if(lf){end = lf - in.data() + 1;}
+        break;
+      }
+      case FRAME_BLOCK:
+      case FRAME_TX: {
+        if(it->framing == FRAME_TX){
+          const char *sp((const char *)memchr(in.data() + pos, ' ', in.size() - pos));
+          if(!sp){break;}
+          head = sp - in.data() + 1;
+        }
+        if(in.size() - head < 1){break;}
+        if((in[head] != '#')
+            || ((in.size() - head >= 2) && ((in[head + 1] < '1') || (in[head + 1] > '9')))){
+          it->framing = FRAME_LINE; // not a block, fall back to a line
+          continue;
+        }
+        if(in.size() - head < 2){break;}
+        size_t digits(in[head + 1] - '0');
+        if(in.size() - head < 2 + digits){break;}
+        size_t length(strtoul(in.substr(head + 2, digits).c_str(), NULL, 10));
+        size_t lf(head + 2 + digits + length);
+        if(lf < in.size()){end = lf + ((in[lf] == '\n') ? 1 : 0);}
+        break;
+      }
+    }
+    if(end == std::string::npos){break;}
+    if(it->tag >= 0){
+      replies[it->ticket] = in.substr(head, end - head);
+    }else{
+      replies[it->ticket] = in.substr(pos, end - pos);
+    }
+    pendings.erase(pendings.begin(), it + 1); // the skipped ones are lost
+    pos = end;
+  }
+  in.erase(0, pos);
+}
+
+bool Adapter::pump(bool all, int timeout_ms){
+  struct epoll_event ev;
+  int n(epoll_wait(epfd, &ev, 1, timeout_ms));
+  if(n < 0){
+    if(errno == EINTR){return true;}
+    throw Error(errno_str("epoll_wait"));
+  }
+  if(n == 0){return false;}
+  if(ev.events & EPOLLOUT){try_write(all);}
+  if(ev.events & (EPOLLIN | EPOLLHUP | EPOLLERR)){try_read();}
+  return true;
+}
+
+static uint64_t now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+std::string Adapter::wait(uint64_t ticket, int timeout_ms){
+  uint64_t start(now_ns());
+  try_write(true); // the rest of the chunk
+  while(true){
+    std::map<uint64_t, std::string>::iterator it(replies.find(ticket));
+    if(it != replies.end()){
+      std::string res;
+      res.swap(it->second);
+      replies.erase(it);
+      return res;
+    }
+    if(ticket >= next_ticket){throw Error("no such ticket");}
+    if(!is_pending(ticket)){throw Error("no reply");}
+    int remain(timeout_ms);
+    if(timeout_ms >= 0){
+      remain = timeout_ms - (int)((now_ns() - start) / 1000000);
+      if(remain < 0){remain = 0;}
+    }
+    if(!pump(true, remain)){
+      // The order of the replies is lost; drop everything pending.
+      pendings.clear();
+      replies.clear();
+      in.clear();
+      throw Error("timeout");
+    }
+  }
+}
+
+void Adapter::drain(int quiet_ms){
+  flush();
+  while(pump(true, quiet_ms)){}
+  pendings.clear();
+  replies.clear();
+  in.clear();
+}
+
+} // namespace gpib_usb
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Host library of the adapter protocol (Prologix compatible), for Linux.
+ *
+ * - Data are escaped with ESC (0x1B) before '+', CR, LF and ESC.
+ * - Output is buffered and written in multiples of 64 bytes (the bulk packet size)
+ *   while more follows, so that a batch of commands costs a few write(2)s.
+ * - Queries are pipelined; submit() returns immediately, and replies are
+ *   split from the input stream incrementally in the order of submission.
+ *   Queries to devices are "++tx" transactions, whose replies are matched by tag,
+ *   so that a device which does not answer costs only its own reply.
+ * - The serial port is non-blocking and waited with epoll.
+ */
+
+#ifndef __GPIB_ADAPTER_H__
+#define __GPIB_ADAPTER_H__
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <map>
+#include <stdexcept>
+
+namespace gpib_usb {
+
+class Error : public std::runtime_error {
+public:
+  Error(const std::string &what) : std::runtime_error(what) {}
+};
+
+class Adapter {
+public:
+  // How a reply ends in the input stream
+  enum framing_t {
+    FRAME_LINE, // LF
+    FRAME_LINE_CR, // CR, with which ++eos 1 ends replies
+    FRAME_BLOCK, // IEEE-488.2 definite length block "#<n><length><data>", and the following LF
+    FRAME_TX, // reply of ++tx, "<tag> " followed by a block or a line
+  };
+
+  static const unsigned chunk_size = 64;
+
+  explicit Adapter(const std::string &path);
+  ~Adapter();
+
+  static std::string escape(const std::string &data);
+
+  // Queue "++<cmd>\n"; it is sent with the next flush() or wait().
+  void command(const std::string &cmd);
+
+  // Queue data to the current address with terminator (CR LF by ++eos 0)
+  void write(const std::string &data);
+
+  /**
+   * Queue a query to a device as "++tx <tag> <pad>" followed by the query.
+   * The reply is returned without "<tag> ", and is an empty line (terminator only)
+   * when the device does not answer within ++read_tmo_ms.
+   * framing is that of the reply of the device, FRAME_LINE, FRAME_LINE_CR or FRAME_BLOCK.
+   * ++auto should be 0.
+   * @return ticket, to be passed to wait()
+   */
+  uint64_t submit(int pad, const std::string &query, framing_t framing = FRAME_LINE);
+
+  // Queue "++<cmd>\n" whose reply is a line, for example "ver", "spoll 5", "srq"
+  uint64_t submit_command(const std::string &cmd, framing_t framing = FRAME_LINE);
+
+  // Write out the queued output
+  void flush();
+
+  /**
+   * Wait for the reply of the ticket; earlier replies are kept for their wait().
+   * @throw Error when timeout, which also discards the pending replies,
+   * or when the reply was lost, i.e., a later tag arrived before it
+   */
+  std::string wait(uint64_t ticket, int timeout_ms = 3000);
+
+  // Discard the input until nothing arrives for quiet_ms, for example after timeout
+  void drain(int quiet_ms);
+
+  std::string query(int pad, const std::string &query, framing_t framing = FRAME_LINE){
+    return wait(submit(pad, query, framing));
+  }
+
+  // Counters
+  uint64_t writes, reads, bytes_written, bytes_read;
+
+private:
+  struct pending_t {
+    uint64_t ticket;
+    framing_t framing;
+    int tag; // of ++tx queued by submit(), or -1 for a reply taken by its position
+  };
+
+  int fd, epfd;
+  bool want_write;
+  std::string out, in;
+  uint64_t next_ticket;
+  std::deque<pending_t> pendings; // replies not received yet, in order of submission
+  std::map<uint64_t, std::string> replies; // received, but not waited yet
+
+  void queue(const std::string &str);
+  uint64_t expect(framing_t framing, int tag = -1);
+  bool is_pending(uint64_t ticket) const;
+  bool pump(bool all, int timeout_ms); // one epoll_wait
+  void try_write(bool all);
+  void try_read();
+  void split_replies();
+  Adapter(const Adapter &);
+  Adapter &operator=(const Adapter &);
+};
+
+} // namespace gpib_usb
+
+#endif /* __GPIB_ADAPTER_H__ */
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Message format of HiSLIP (IVI-6.1, High-Speed LAN Instrument Protocol)
+ */
+
+#ifndef __HISLIP_H__
+#define __HISLIP_H__
+
+#include <stdint.h>
+#include <string>
+
+namespace hislip {
+
+enum message_type_t {
+  INITIALIZE = 0,
+  INITIALIZE_RESPONSE = 1,
+  FATAL_ERROR = 2,
+  ERROR = 3,
+  ASYNC_LOCK = 4,
+  ASYNC_LOCK_RESPONSE = 5,
+  DATA = 6,
+  DATA_END = 7,
+  DEVICE_CLEAR_COMPLETE = 8,
+  DEVICE_CLEAR_ACKNOWLEDGE = 9,
+  ASYNC_REMOTE_LOCAL_CONTROL = 10,
+  ASYNC_REMOTE_LOCAL_RESPONSE = 11,
+  TRIGGER = 12,
+  INTERRUPTED = 13,
+  ASYNC_INTERRUPTED = 14,
+  ASYNC_MAXIMUM_MESSAGE_SIZE = 15,
+  ASYNC_MAXIMUM_MESSAGE_SIZE_RESPONSE = 16,
+  ASYNC_INITIALIZE = 17,
+  ASYNC_INITIALIZE_RESPONSE = 18,
+  ASYNC_DEVICE_CLEAR = 19,
+  ASYNC_SERVICE_REQUEST = 20,
+  ASYNC_STATUS_QUERY = 21,
+  ASYNC_STATUS_RESPONSE = 22,
+  ASYNC_DEVICE_CLEAR_ACKNOWLEDGE = 23,
+  ASYNC_LOCK_INFO = 24,
+  ASYNC_LOCK_INFO_RESPONSE = 25,
+};
+
+enum fatal_error_t { // control code of FatalError
+  FATAL_UNIDENTIFIED = 0,
+  FATAL_POORLY_FORMED_HEADER = 1,
+  FATAL_NOT_INITIALIZED = 2, // attempt to use connection without both channels established
+  FATAL_INVALID_INIT = 3, // invalid initialization sequence
+  FATAL_MAX_CLIENTS = 4,
+};
+
+enum error_t { // control code of Error
+  ERROR_UNIDENTIFIED = 0,
+  ERROR_UNRECOGNIZED_TYPE = 1,
+  ERROR_UNRECOGNIZED_CONTROL = 2,
+  ERROR_UNRECOGNIZED_VENDOR = 3,
+  ERROR_TOO_LARGE = 4,
+};
+
+static const uint16_t PROTOCOL_VERSION = 0x0100; // 1.0
+static const uint32_t FIRST_MESSAGE_ID = 0xFFFFFF00;
+
+inline uint64_t decode_u64(const char *buf){
+  uint64_t res(0);
+  for(int i(0); i < 8; ++i){res = (res << 8) | (uint8_t)buf[i];}
+  return res;
+}
+
+inline std::string encode_u64(uint64_t v){
+  std::string res(8, '\0');
+  for(int i(7); i >= 0; --i, v >>= 8){res[i] = (char)(v & 0xFF);}
+  return res;
+}
+
+// 16 bytes; "HS", type, control code, parameter (32 bits), payload length (64 bits), big endian
+struct header_t {
+  static const unsigned size = 16;
+  uint8_t type, control;
+  uint32_t param;
+  uint64_t length;
+
+  header_t() : type(0), control(0), param(0), length(0) {}
+  header_t(uint8_t type_, uint8_t control_, uint32_t param_, uint64_t length_)
+      : type(type_), control(control_), param(param_), length(length_) {}
+
+  std::string encode() const {
+    std::string res("HS");
+    res += (char)type;
+    res += (char)control;
+    res += encode_u64(param).substr(4);
+    res += encode_u64(length);
+    return res;
+  }
+  bool decode(const char *buf){
+    if((buf[0] != 'H') || (buf[1] != 'S')){return false;}
+    type = (uint8_t)buf[2];
+    control = (uint8_t)buf[3];
+    param = 0;
+    for(int i(4); i < 8; ++i){param = (param << 8) | (uint8_t)buf[i];}
+    length = decode_u64(buf + 8);
+    return true;
+  }
+};
+
+} // namespace hislip
+
+#endif /* __HISLIP_H__ */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "bus.h"
+
+namespace sim {
+
+Bus bus;
+
+void Bus::detach(Device *dev){
+  for(std::vector<Device *>::iterator it(devices.begin()); it != devices.end(); ++it){
+    if(*it == dev){
+      devices.erase(it);
+      return;
+    }
+  }
+}
+
+void Bus::resolve(){
+  resolves++;
+  for(int i(0); i < 16; ++i){
+    uint8_t data(adapter_data), ctrl(adapter_ctrl);
+    for(std::vector<Device *>::const_iterator it(devices.begin()); it != devices.end(); ++it){
+      data &= (*it)->data_out;
+      ctrl &= (*it)->ctrl_out;
+    }
+    if((i > 0) && (data == data_level) && (ctrl == ctrl_level)){break;}
+    data_level = data;
+    ctrl_level = ctrl;
+    for(std::vector<Device *>::const_iterator it(devices.begin()); it != devices.end(); ++it){
+      (*it)->update(*this);
+    }
+  }
+}
+
+} // namespace sim
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * GPIB bus model; open-collector wired-AND of DIO1-8 and the eight control lines.
+ * The adapter (firmware through P1/P2) and virtual instruments are its drivers.
+ */
+
+#ifndef __BUS_H__
+#define __BUS_H__
+
+#include <stdint.h>
+#include <vector>
+
+namespace sim {
+
+extern uint64_t now_ns; // simulated time
+
+// GPIB lines on P2, whose level is electrical (0 = asserted)
+enum {
+  SRQ = 0x01, ATN = 0x02, EOI = 0x04, DAV = 0x08,
+  NRFD = 0x10, NDAC = 0x20, IFC = 0x40, REN = 0x80,
+};
+
+class Bus;
+
+/**
+ * Device on the GPIB bus, which drives lines in open-collector manner.
+ * update() is invoked whenever the bus may have changed, and should change
+ * data_out/ctrl_out (0 = assert) according to Bus::data()/Bus::ctrl().
+ */
+class Device {
+public:
+  uint8_t data_out, ctrl_out;
+  Device() : data_out(0xFF), ctrl_out(0xFF) {}
+  virtual ~Device() {}
+  virtual void update(const Bus &bus) = 0;
+};
+
+class Bus {
+public:
+  std::vector<Device *> devices;
+  uint8_t adapter_data, adapter_ctrl; // lines driven by the adapter
+  uint8_t data_level, ctrl_level; // resolved levels
+  uint64_t resolves; // for profiling
+  Bus() : adapter_data(0xFF), adapter_ctrl(0xFF), data_level(0xFF), ctrl_level(0xFF), resolves(0) {}
+  uint8_t data() const {return data_level;}
+  uint8_t ctrl() const {return ctrl_level;}
+  void attach(Device *dev){devices.push_back(dev);}
+  void detach(Device *dev);
+  void detach_all(){devices.clear();}
+  void resolve(); // wired-AND of all drivers, repeated until devices settle
+};
+
+extern Bus bus;
+
+} // namespace sim
+
+#endif /* __BUS_H__ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "instrument.h"
+
+namespace sim {
+
+Instrument::Instrument(uint8_t pad_)
+    : Device(), pad(pad_),
+    listening(false), talking(false), serial_poll_mode(false), status(0),
+    received(), output(),
+    messages(0), triggers(0), clears(0), accept_delay_ns(0),
+    ah_state(ACCEPT_READY), sh_state(SOURCE_IDLE), accept_at(0), source_at(0), last_primary(0) {}
+
+void Instrument::request_service(uint8_t stb){
+  status = stb | 0x40;
+}
+
+void Instrument::talk(const std::string &str, bool eoi){
+  for(std::string::size_type i(0); i < str.size(); ++i){
+    output.push_back(std::make_pair((uint8_t)str[i], eoi && (i + 1 == str.size())));
+  }
+}
+
+void Instrument::command(uint8_t cmd){
+  cmd &= 0x7F;
+  switch(cmd){
+    case 0x3F: listening = false; return; // UNL
+    case 0x5F: talking = false; return; // UNT
+    case 0x14: on_clear(); return; // DCL
+    case 0x18: serial_poll_mode = true; return; // SPE
+    case 0x19: serial_poll_mode = false; return; // SPD
+    case 0x04: if(listening){on_clear();} return; // SDC
+    case 0x08: if(listening){on_trigger();} return; // GET
+  }
+  switch(cmd & 0x60){
+    case 0x20: // LAD; MLA also unaddresses the talker
+      last_primary = cmd;
+      if((cmd & 0x1F) == pad){listening = true; talking = false;}
+      break;
+    case 0x40: // TAD; MTA also unaddresses the listener
+      last_primary = cmd;
+      talking = ((cmd & 0x1F) == pad);
+      if(talking){listening = false;}
+      break;
+    case 0x60: // SAD, which is accepted for any value
+      break;
+    default:
+      last_primary = 0;
+  }
+}
+
+void Instrument::accept(uint8_t byte, bool eoi, bool atn){
+  if(atn){
+    command(byte);
+    return;
+  }
+  if(!listening){return;}
+  received += (char)byte;
+  if(eoi || (byte == '\n')){
+    std::string msg;
+    msg.swap(received);
+    on_message(msg);
+  }
+}
+
+void Instrument::update(const Bus &bus){
+  uint8_t ctrl(bus.ctrl());
+  bool atn(!(ctrl & ATN));
+
+  if(!(ctrl & IFC)){ // interface clear
+    listening = talking = serial_poll_mode = false;
+  }
+
+  // service request
+  ctrl_out = (status & 0x40) ? (ctrl_out & ~SRQ) : (ctrl_out | SRQ);
+
+  // acceptor handshake, for commands and addressed listener
+  uint8_t ah_out(ctrl_out & (NRFD | NDAC));
+  if(atn || listening){
+    bool dav(!(ctrl & DAV));
+    switch(ah_state){
+      case ACCEPT_READY:
+        if(!dav){
+          ctrl_out = (ctrl_out & ~NDAC) | NRFD;
+          break;
+        }
+        ctrl_out &= ~NRFD;
+        accept(~bus.data(), !(ctrl & EOI), atn);
+        accept_at = now_ns + accept_delay_ns;
+        ah_state = ACCEPT_DELAY;
+        // fall through
+      case ACCEPT_DELAY:
+        if(now_ns < accept_at){break;}
+        ctrl_out |= NDAC;
+        ah_state = ACCEPT_DONE;
+        break;
+      case ACCEPT_DONE:
+        if(dav){break;}
+        ctrl_out &= ~NDAC;
+        ah_state = ACCEPT_READY;
+        break;
+    }
+  }else{
+    ctrl_out |= (NRFD | NDAC);
+    ah_state = ACCEPT_READY;
+  }
+
+  // let the bus settle before the source handshake looks at NRFD / NDAC,
+  // otherwise the talker would see what it drove itself as an acceptor.
+  if((ctrl_out & (NRFD | NDAC)) != ah_out){return;}
+
+  // source handshake, for addressed talker
+  if(talking && !atn && (serial_poll_mode || !output.empty())){
+    switch(sh_state){
+      case SOURCE_IDLE:
+        if(serial_poll_mode){
+          data_out = ~status;
+          ctrl_out |= EOI;
+        }else{
+          data_out = ~output.front().first;
+          ctrl_out = output.front().second ? (ctrl_out & ~EOI) : (ctrl_out | EOI);
+        }
+        source_at = now_ns + settling_ns;
+        sh_state = SOURCE_WAIT_NRFD;
+        // fall through
+      case SOURCE_WAIT_NRFD: // NRFD high with NDAC low, i.e. some listener is ready
+        if((now_ns < source_at) || !(ctrl & NRFD) || (ctrl & NDAC)){break;}
+        ctrl_out &= ~DAV;
+        sh_state = SOURCE_WAIT_NDAC;
+        break;
+      case SOURCE_WAIT_NDAC:
+        if(!(ctrl & NDAC)){break;}
+        ctrl_out |= (DAV | EOI);
+        data_out = 0xFF;
+        if(serial_poll_mode){
+          status &= ~0x40;
+          ctrl_out |= SRQ;
+        }else{
+          output.pop_front();
+        }
+        sh_state = SOURCE_IDLE;
+        break;
+    }
+  }else{
+    data_out = 0xFF;
+    ctrl_out |= (DAV | EOI);
+    sh_state = SOURCE_IDLE;
+  }
+}
+
+std::string BlockTalker::payload(size_t size){
+  std::string res(size, '\0');
+  for(size_t i(0); i < size; ++i){
+    res[i] = (char)((i * 7) + (i >> 8)); // includes CR, LF and NUL
+  }
+  return res;
+}
+
+std::string BlockTalker::block(size_t size){
+  char len[24];
+  snprintf(len, sizeof(len), "%zu", size);
+  char digits[4];
+  snprintf(digits, sizeof(digits), "%zu", strlen(len));
+  return std::string("#") + digits + len + payload(size) + "\n";
+}
+
+void BlockTalker::on_message(const std::string &msg){
+  Instrument::on_message(msg);
+  std::string::size_type last(msg.find_last_not_of("\r\n"));
+  if((last != std::string::npos) && (msg[last] == '?')){
+    talk(block(size));
+  }
+}
+
+void SrqAsserter::update(const Bus &bus){
+  if(complete_at && (now_ns >= complete_at)){
+    complete_at = 0;
+    request_service(stb);
+  }
+  Instrument::update(bus);
+}
+
+void ScriptedInstrument::on_message(const std::string &msg){
+  Instrument::on_message(msg);
+  std::string query(msg, 0, msg.find_last_not_of("\r\n") + 1);
+  std::map<std::string, std::string>::const_iterator it(script.find(query));
+  if(it != script.end()){
+    talk(it->second);
+  }else if(!unknown.empty()){
+    talk(unknown);
+  }
+}
+
+} // namespace sim
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * IEEE-488.1 instrument on the simulated bus, which implements
+ * acceptor/source handshake, addressing, serial poll, and service request.
+ * Derived classes give behavior through on_message(), on_trigger() and on_clear().
+ */
+
+#ifndef __INSTRUMENT_H__
+#define __INSTRUMENT_H__
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <utility>
+#include <map>
+
+#include "bus.h"
+
+namespace sim {
+
+class Instrument : public Device {
+public:
+  uint8_t pad;
+  bool listening, talking, serial_poll_mode;
+  uint8_t status; // serial poll status byte; 0x40 (RQS) asserts SRQ
+  std::string received; // incomplete message
+  std::deque<std::pair<uint8_t, bool> > output; // bytes to be sent and EOI flags
+  uint64_t messages, triggers, clears;
+  uint64_t accept_delay_ns; // delay before accepting each byte, for slow listeners
+  static const unsigned settling_ns = 350; // T1, from data valid to DAV asserted
+  Instrument(uint8_t pad_);
+  virtual ~Instrument() {}
+  void update(const Bus &bus);
+  void request_service(uint8_t stb); // set status with RQS
+  void talk(const std::string &str, bool eoi = true); // queue a message
+protected:
+  virtual void on_message(const std::string &msg) {messages++;}
+  virtual void on_trigger() {triggers++;}
+  virtual void on_clear() {clears++;}
+private:
+  enum {ACCEPT_READY, ACCEPT_DELAY, ACCEPT_DONE} ah_state;
+  enum {SOURCE_IDLE, SOURCE_WAIT_NRFD, SOURCE_WAIT_NDAC} sh_state;
+  uint64_t accept_at, source_at;
+  uint8_t last_primary; // the last LAD/TAD to us, for secondary address
+  void command(uint8_t cmd);
+  void accept(uint8_t byte, bool eoi, bool atn);
+};
+
+// Replies with the last received message
+class EchoInstrument : public Instrument {
+public:
+  EchoInstrument(uint8_t pad_) : Instrument(pad_) {}
+protected:
+  void on_message(const std::string &msg){
+    Instrument::on_message(msg);
+    talk(msg);
+  }
+};
+
+// Accepts each byte after delay_ns, and counts the received bytes without storing messages
+class SlowListener : public Instrument {
+public:
+  uint64_t bytes;
+  SlowListener(uint8_t pad_, uint64_t delay_ns) : Instrument(pad_), bytes(0) {
+    accept_delay_ns = delay_ns;
+  }
+protected:
+  void on_message(const std::string &msg){
+    Instrument::on_message(msg);
+    bytes += msg.size();
+  }
+};
+
+/**
+ * Replies to any query (message ending with '?') with an IEEE-488.2
+ * definite length arbitrary block, "#<digits><length><payload>\n" with EOI.
+ */
+class BlockTalker : public Instrument {
+public:
+  size_t size;
+  BlockTalker(uint8_t pad_, size_t size_) : Instrument(pad_), size(size_) {}
+  static std::string payload(size_t size); // every byte value appears
+  static std::string block(size_t size);
+protected:
+  void on_message(const std::string &msg);
+};
+
+/**
+ * Starts a "measurement" by a trigger (GET) or any message, and when it completes
+ * after delay_ns, requests service with status stb (RQS is added).
+ */
+class SrqAsserter : public Instrument {
+public:
+  uint8_t stb;
+  uint64_t delay_ns;
+  SrqAsserter(uint8_t pad_, uint8_t stb_, uint64_t delay_ns_)
+      : Instrument(pad_), stb(stb_), delay_ns(delay_ns_), complete_at(0) {}
+  void update(const Bus &bus);
+protected:
+  void on_message(const std::string &msg){
+    Instrument::on_message(msg);
+    start();
+  }
+  void on_trigger(){
+    Instrument::on_trigger();
+    start();
+  }
+private:
+  uint64_t complete_at; // 0 when idle
+  void start(){complete_at = now_ns + delay_ns;}
+};
+
+// Replies according to a table of query and response; trailing CR/LF of queries are ignored.
+class ScriptedInstrument : public Instrument {
+public:
+  std::map<std::string, std::string> script;
+  std::string unknown; // reply for queries out of the table, nothing if empty
+  ScriptedInstrument(uint8_t pad_) : Instrument(pad_), script(), unknown() {}
+  ScriptedInstrument &respond(const std::string &query, const std::string &reply){
+    script[query] = reply;
+    return *this;
+  }
+protected:
+  void on_message(const std::string &msg);
+};
+
+} // namespace sim
+
+#endif /* __INSTRUMENT_H__ */
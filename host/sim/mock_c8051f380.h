@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Mock of c8051f380.h for the host build of the firmware.
+ * This header is force-included (-include) before any firmware source
+ * which is compiled as C++, and declares every SFR as an object
+ * whose accesses are forwarded to the simulator (see sim.h).
+ * The include guard of the real header is defined here,
+ * so that the following inclusion by firmware sources has no effect.
+ */
+
+#ifndef __MOCK_C8051F380_H__
+#define __MOCK_C8051F380_H__
+
+namespace sim {
+
+unsigned char sfr_read(unsigned char addr);
+unsigned char sfr_read_latch(unsigned char addr); // for read-modify-write instructions
+void sfr_write(unsigned char addr, unsigned char value);
+
+template <unsigned A>
+struct Sfr8 {
+  operator unsigned char() const {return sfr_read(A);}
+  Sfr8 &operator=(unsigned char v){sfr_write(A, v); return *this;}
+  Sfr8 &operator|=(unsigned char v){sfr_write(A, sfr_read_latch(A) | v); return *this;}
+  Sfr8 &operator&=(unsigned char v){sfr_write(A, sfr_read_latch(A) & v); return *this;}
+  Sfr8 &operator^=(unsigned char v){sfr_write(A, sfr_read_latch(A) ^ v); return *this;}
+};
+
+// A is (high address << 8 | low address), and the low byte is accessed first.
+template <unsigned A>
+struct Sfr16 {
+  operator unsigned short() const {
+    unsigned char l = sfr_read(A & 0xFF);
+    return (unsigned short)((sfr_read(A >> 8) << 8) | l);
+  }
+  Sfr16 &operator=(unsigned short v){
+    sfr_write(A & 0xFF, (unsigned char)v);
+    sfr_write(A >> 8, (unsigned char)(v >> 8));
+    return *this;
+  }
+};
+
+// A is bit address, whose upper 5 bits and 3 zero bits make the byte address.
+template <unsigned A>
+struct Sbit {
+  operator bool() const {return (sfr_read(A & 0xF8) >> (A & 0x07)) & 0x01;}
+  Sbit &operator=(bool v){
+    unsigned char mask = (unsigned char)(1 << (A & 0x07));
+    unsigned char latch = sfr_read_latch(A & 0xF8);
+    sfr_write(A & 0xF8, v ? (latch | mask) : (latch & ~mask));
+    return *this;
+  }
+};
+
+} // namespace sim
+
+#ifndef MOCK_SFR_DEFINE
+#define MOCK_SFR_DEFINE extern
+#endif
+#define __sfr MOCK_SFR_DEFINE sim::Sfr8
+#define __sfr16 MOCK_SFR_DEFINE sim::Sfr16
+#define __sbit MOCK_SFR_DEFINE sim::Sbit
+#define __at(x) <x>
+#include "c8051f380.h"
+#undef __sfr
+#undef __sfr16
+#undef __sbit
+#undef __at
+
+#endif /* __MOCK_C8051F380_H__ */
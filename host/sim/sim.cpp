@@ -0,0 +1,530 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <string.h>
+#include <stdexcept>
+
+// SFR objects are defined here.
+#define MOCK_SFR_DEFINE
+#include "mock_c8051f380.h"
+
+#include "main.h"
+#include "gpib.h"
+#include "f38x_usb.h"
+#include "f38x_usb_register.h"
+#include "f38x_flash.h"
+#include "stats.h"
+
+#include "sim.h"
+
+// Functions of main.c, which have no prototype in headers
+void sysclk_init();
+void port_init();
+void timer_init();
+void interrupt_timer3();
+
+namespace sim {
+
+uint64_t now_ns = 0;
+unsigned access_ns = 125; // 6 cycles at 48 MHz
+Usb usb;
+Flash flash;
+
+enum {
+  A_P0 = 0x80, A_P1 = 0x90, A_P2 = 0xA0, A_P3 = 0xB0,
+  A_TMR3CN = 0x91, A_TMR3RLL = 0x92, A_TMR3RLH = 0x93, A_TMR3L = 0x94, A_TMR3H = 0x95,
+  A_USB0ADR = 0x96, A_USB0DAT = 0x97,
+  A_IE = 0xA8, A_OSCICN = 0xB2, A_CLKMUL = 0xB9, A_REG01CN = 0xC9,
+  A_PCA0CN = 0xD8, A_PCA0MD = 0xD9, A_EIE1 = 0xE6, A_RSTSRC = 0xEF,
+  A_PCA0L = 0xF9, A_PCA0H = 0xFA,
+};
+
+// P0 bits controlling the transceivers
+enum {TE = 0x10, SC = 0x20, DC = 0x40};
+
+static uint8_t regs[0x100];
+static bool in_isr;
+
+// ---- GPIB bus ----
+
+// Lines on P2 whose transceiver direction is transmit
+static uint8_t ctrl_transmit_mask(){
+  uint8_t p0(regs[A_P0]), mask(0);
+  mask |= (p0 & TE) ? (DAV | EOI) : (NRFD | NDAC);
+  mask |= (p0 & DC) ? SRQ : ATN;
+  mask |= (p0 & SC) ? (REN | IFC) : 0;
+  return mask;
+}
+
+static void bus_update(){
+  uint8_t mask(ctrl_transmit_mask());
+  bus.adapter_ctrl = regs[A_P2] | ~mask;
+  bus.adapter_data = (regs[A_P0] & TE) ? regs[A_P1] : 0xFF;
+  bus.resolve();
+}
+
+static uint8_t bus_read_p1(){
+  bus_update();
+  return (regs[A_P0] & TE) ? regs[A_P1] : (regs[A_P1] & bus.data());
+}
+
+static uint8_t bus_read_p2(){
+  bus_update();
+  uint8_t mask(ctrl_transmit_mask());
+  return (regs[A_P2] & mask) | (regs[A_P2] & bus.ctrl() & ~mask);
+}
+
+// ---- Timer3, 4 MHz (SYSCLK/12) ----
+
+static uint16_t t3_count;
+static uint64_t t3_last_ns;
+
+static void timer3_advance(){
+  uint64_t ticks((now_ns - t3_last_ns) / 250);
+  t3_last_ns += ticks * 250;
+  if(!(regs[A_TMR3CN] & 0x04)){return;}
+  while(ticks > 0){
+    uint32_t room(0x10000 - t3_count);
+    if(ticks < room){
+      t3_count += (uint16_t)ticks;
+      break;
+    }
+    ticks -= room;
+    t3_count = (uint16_t)((regs[A_TMR3RLH] << 8) | regs[A_TMR3RLL]);
+    regs[A_TMR3CN] |= 0x80; // TF3H
+  }
+}
+
+// ---- PCA0 counter ----
+
+static uint16_t pca_base;
+static uint64_t pca_base_ns;
+
+static uint16_t pca_count(){
+  if(!(regs[A_PCA0CN] & 0x40)){return pca_base;}
+  unsigned div;
+  switch((regs[A_PCA0MD] >> 1) & 0x07){
+    case 1: div = 4; break;
+    case 4: div = 1; break;
+    default: div = 12; break;
+  }
+  return (uint16_t)(pca_base + (now_ns - pca_base_ns) * 48 / 1000 / div);
+}
+
+static void pca_rebase(){
+  pca_base = pca_count();
+  pca_base_ns = now_ns;
+}
+
+// ---- USB0 ----
+
+struct Endpoint {
+  std::deque<uint8_t> in_fifo, out_fifo;
+  uint8_t incsr1, incsr2, outcsr1, outcsr2;
+  uint64_t in_ready_ns, out_sent_ns;
+};
+
+static Endpoint ep[4];
+static uint8_t usb_faddr, usb_power, usb_index, usb_clkrec;
+static uint8_t usb_in1int, usb_out1int, usb_cmint, usb_in1ie, usb_out1ie, usb_cmie;
+static uint8_t usb0adr, usb0dat;
+static bool ep0_stall, ep0_dataend, usb_configured;
+
+static uint8_t usb_reg_read(uint8_t addr){
+  Endpoint &e(ep[usb_index & 0x03]);
+  uint8_t res(0);
+  switch(addr){
+    case FADDR: return usb_faddr;
+    case POWER: return usb_power;
+    case IN1INT: res = usb_in1int; usb_in1int = 0; return res;
+    case OUT1INT: res = usb_out1int; usb_out1int = 0; return res;
+    case CMINT: res = usb_cmint; usb_cmint = 0; return res;
+    case IN1IE: return usb_in1ie;
+    case OUT1IE: return usb_out1ie;
+    case CMIE: return usb_cmie;
+    case FRAMEL: return (uint8_t)(now_ns / 1000000);
+    case FRAMEH: return (uint8_t)((now_ns / 1000000) >> 8) & 0x07;
+    case INDEX: return usb_index;
+    case CLKREC: return usb_clkrec;
+    case EINCSR1: return e.incsr1 | ((usb_index > 0) && !e.in_fifo.empty() ? rbInFIFONE : 0);
+    case EINCSR2: return e.incsr2;
+    case EOUTCSR1: return e.outcsr1;
+    case EOUTCSR2: return e.outcsr2;
+    case EOUTCNTL: return (uint8_t)e.out_fifo.size();
+    case EOUTCNTH: return (uint8_t)(e.out_fifo.size() >> 8);
+    case FIFO_EP0: case FIFO_EP1: case FIFO_EP2: case FIFO_EP3: {
+      Endpoint &f(ep[addr - FIFO_EP0]);
+      if(f.out_fifo.empty()){return 0;}
+      res = f.out_fifo.front();
+      f.out_fifo.pop_front();
+      return res;
+    }
+  }
+  return 0;
+}
+
+static void usb_reg_write(uint8_t addr, uint8_t v){
+  Endpoint &e(ep[usb_index & 0x03]);
+  switch(addr){
+    case FADDR: usb_faddr = v; break;
+    case POWER: usb_power = v; break;
+    case IN1IE: usb_in1ie = v; break;
+    case OUT1IE: usb_out1ie = v; break;
+    case CMIE: usb_cmie = v; break;
+    case INDEX: usb_index = v; break;
+    case CLKREC: usb_clkrec = v; break;
+    case E0CSR: // == EINCSR1
+      if(usb_index == 0){
+        if(v & rbSOPRDY){
+          e.incsr1 &= ~rbOPRDY;
+          e.out_fifo.clear();
+        }
+        if(v & rbSSUEND){e.incsr1 &= ~rbSUEND;}
+        if(v & rbSDSTL){ep0_stall = true;}
+        if(!(v & rbSTSTL)){e.incsr1 &= ~rbSTSTL;}
+        if(v & rbDATAEND){ep0_dataend = true;}
+        if(v & rbINPRDY){e.incsr1 |= rbINPRDY;}
+      }else{
+        if(v & rbInFLUSH){
+          e.in_fifo.clear();
+          e.incsr1 &= ~rbInINPRDY;
+        }
+        e.incsr1 = (e.incsr1 & ~rbInSDSTL) | (v & rbInSDSTL);
+        if(!(v & rbInSTSTL)){e.incsr1 &= ~rbInSTSTL;}
+        if(v & rbInINPRDY){
+          e.incsr1 |= rbInINPRDY;
+          e.in_ready_ns = now_ns;
+        }
+      }
+      break;
+    case EINCSR2: e.incsr2 = v; break;
+    case EOUTCSR1:
+      if(v & rbOutFLUSH){e.out_fifo.clear();}
+      e.outcsr1 = (e.outcsr1 & ~rbOutSDSTL) | (v & rbOutSDSTL);
+      if(!(v & rbOutSTSTL)){e.outcsr1 &= ~rbOutSTSTL;}
+      if(!(v & rbOutOPRDY)){ // release the packet
+        e.outcsr1 &= ~rbOutOPRDY;
+        e.out_fifo.clear();
+      }
+      break;
+    case EOUTCSR2: e.outcsr2 = v; break;
+    case FIFO_EP0: case FIFO_EP1: case FIFO_EP2: case FIFO_EP3:
+      ep[addr - FIFO_EP0].in_fifo.push_back(v);
+      break;
+  }
+}
+
+static bool usb_irq_pending(){
+  return (usb_in1int & usb_in1ie) || (usb_out1int & usb_out1ie) || (usb_cmint & usb_cmie);
+}
+
+// Host side activity on the bulk/interrupt endpoints
+static void usb_service(){
+  if(!usb.attached){return;}
+  for(int i(1); i < 4; ++i){
+    Endpoint &e(ep[i]);
+    if((e.incsr1 & rbInINPRDY) && (now_ns - e.in_ready_ns >= usb.packet_ns)){
+      if(i == 2){
+        if(usb.in_paused){continue;}
+        usb.from_device.append(e.in_fifo.begin(), e.in_fifo.end());
+        usb.in_packets++;
+      }
+      e.in_fifo.clear();
+      e.incsr1 &= ~rbInINPRDY;
+      usb_in1int |= (uint8_t)(1 << i);
+    }
+  }
+  if(usb_configured && !usb.to_device.empty()){
+    Endpoint &e(ep[2]);
+    if((!(e.outcsr1 & rbOutOPRDY)) && (now_ns - e.out_sent_ns >= usb.packet_ns)){
+      size_t size(usb.to_device.size());
+      if(size > PACKET_SIZE_EP2){size = PACKET_SIZE_EP2;}
+      e.out_fifo.assign(usb.to_device.begin(), usb.to_device.begin() + size);
+      usb.to_device.erase(usb.to_device.begin(), usb.to_device.begin() + size);
+      e.outcsr1 |= rbOutOPRDY;
+      e.out_sent_ns = now_ns;
+      usb_out1int |= rbOUT2;
+      usb.out_packets++;
+    }
+  }
+}
+
+// ---- SFR access ----
+
+static void service(){
+  now_ns += access_ns;
+  timer3_advance();
+  usb_service();
+  if(in_isr || !(regs[A_IE] & 0x80)){return;}
+  in_isr = true;
+  if((regs[A_EIE1] & 0x80) && (regs[A_TMR3CN] & 0x80)){interrupt_timer3();}
+  if((regs[A_EIE1] & 0x02) && usb_irq_pending()){usb_isr();}
+  in_isr = false;
+}
+
+unsigned char sfr_read_latch(unsigned char addr){
+  switch(addr){
+    case A_P0: case A_P1: case A_P2: case A_P3:
+      service();
+      return regs[addr];
+  }
+  return sfr_read(addr);
+}
+
+unsigned char sfr_read(unsigned char addr){
+  service();
+  switch(addr){
+    case A_P1: return bus_read_p1();
+    case A_P2: return bus_read_p2();
+    case A_TMR3L: timer3_advance(); return (uint8_t)t3_count;
+    case A_TMR3H: timer3_advance(); return (uint8_t)(t3_count >> 8);
+    case A_USB0ADR: return usb0adr; // never busy
+    case A_USB0DAT: {
+      uint8_t res(usb0dat);
+      if((usb0adr & 0x40) && ((usb0adr & 0x3F) >= FIFO_EP0)){ // auto read
+        usb0dat = usb_reg_read(usb0adr & 0x3F);
+      }
+      return res;
+    }
+    case A_OSCICN: return regs[addr] | 0x40; // oscillator ready
+    case A_CLKMUL: return regs[addr] | 0x20; // multiplier locked
+    case A_REG01CN: return (regs[addr] & ~0x40) | (usb.attached ? 0x40 : 0); // VBUS
+    case A_PCA0L: {
+      uint16_t count(pca_count());
+      regs[A_PCA0H] = (uint8_t)(count >> 8); // snapshot
+      return (uint8_t)count;
+    }
+  }
+  return regs[addr];
+}
+
+void sfr_write(unsigned char addr, unsigned char value){
+  service();
+  switch(addr){
+    case A_TMR3L: timer3_advance(); t3_count = (t3_count & 0xFF00) | value; return;
+    case A_TMR3H: timer3_advance(); t3_count = (t3_count & 0x00FF) | (value << 8); return;
+    case A_TMR3CN: timer3_advance(); break;
+    case A_USB0ADR:
+      usb0adr = value & 0x7F;
+      if(value & 0x80){usb0dat = usb_reg_read(value & 0x3F);}
+      return;
+    case A_USB0DAT: usb_reg_write(usb0adr & 0x3F, value); return;
+    case A_PCA0CN: case A_PCA0MD: pca_rebase(); break;
+    case A_RSTSRC:
+      if(value & 0x10){throw SoftwareReset();}
+      break;
+  }
+  regs[addr] = value;
+  switch(addr){
+    case A_P0: case A_P1: case A_P2: bus_update(); break;
+  }
+}
+
+// ---- USB host ----
+
+bool usb_control(const Setup &setup, std::vector<uint8_t> &data){
+  static const uint64_t timeout_ns(10000000);
+  Endpoint &e0(ep[0]);
+  uint8_t raw[8] = {
+    setup.bmRequestType, setup.bRequest,
+    (uint8_t)setup.wValue, (uint8_t)(setup.wValue >> 8),
+    (uint8_t)setup.wIndex, (uint8_t)(setup.wIndex >> 8),
+    (uint8_t)setup.wLength, (uint8_t)(setup.wLength >> 8)};
+  bool res(true);
+
+  ep0_stall = ep0_dataend = false;
+  e0.in_fifo.clear();
+  e0.out_fifo.assign(raw, raw + sizeof(raw));
+  e0.incsr1 |= rbOPRDY;
+  usb_in1int |= rbEP0;
+  if(!run_until([&]{return ep0_stall || !(e0.incsr1 & rbOPRDY);}, timeout_ns) || ep0_stall){
+    res = false;
+  }else if((setup.bmRequestType & 0x80) && (setup.wLength > 0)){ // IN data stage
+    std::vector<uint8_t> received;
+    while(true){
+      if(!run_until([&]{return ep0_stall || (e0.incsr1 & rbINPRDY);}, timeout_ns) || ep0_stall){
+        res = false;
+        break;
+      }
+      size_t size(e0.in_fifo.size());
+      received.insert(received.end(), e0.in_fifo.begin(), e0.in_fifo.end());
+      e0.in_fifo.clear();
+      e0.incsr1 &= ~rbINPRDY;
+      usb_in1int |= rbEP0;
+      if(ep0_dataend || (size < PACKET_SIZE_EP0) || (received.size() >= setup.wLength)){break;}
+    }
+    if(received.size() > setup.wLength){received.resize(setup.wLength);}
+    data.swap(received);
+  }else if(setup.wLength > 0){ // OUT data stage
+    for(size_t i(0); (i < setup.wLength) && (i < data.size()); i += PACKET_SIZE_EP0){
+      size_t size(data.size() - i);
+      if(size > PACKET_SIZE_EP0){size = PACKET_SIZE_EP0;}
+      e0.out_fifo.assign(data.begin() + i, data.begin() + i + size);
+      e0.incsr1 |= rbOPRDY;
+      usb_in1int |= rbEP0;
+      if(!run_until([&]{return ep0_stall || !(e0.incsr1 & rbOPRDY);}, timeout_ns) || ep0_stall){
+        res = false;
+        break;
+      }
+    }
+  }
+
+  if(ep0_stall){ // handshake the stall
+    ep0_stall = false;
+    e0.incsr1 |= rbSTSTL;
+    res = false;
+  }
+  // status stage
+  usb_in1int |= rbEP0;
+  run_until([&]{return !(usb_in1int & rbEP0);}, timeout_ns);
+  return res;
+}
+
+bool usb_enumerate(){
+  std::vector<uint8_t> buf;
+  if(!usb.attached){
+    usb.attached = true;
+    run_until([]{return usb_mode != USB_INACTIVE;}, 100000000ULL);
+  }
+  usb_cmint |= rbRSTINT;
+  run_until([]{return !(usb_cmint & rbRSTINT);}, 1000000ULL);
+
+  Setup get_device = {0x80, 0x06, 0x0100, 0, 0x40};
+  if(!usb_control(get_device, buf) || (buf.size() != 18)){return false;}
+  Setup set_address = {0x00, 0x05, 0x01, 0, 0};
+  if(!usb_control(set_address, buf) || (usb_faddr != 0x01)){return false;}
+  Setup get_config = {0x80, 0x06, 0x0200, 0, 0x09};
+  if(!usb_control(get_config, buf) || (buf.size() != 9)){return false;}
+  get_config.wLength = (uint16_t)(buf[2] | (buf[3] << 8));
+  if(!usb_control(get_config, buf) || (buf.size() != get_config.wLength)){return false;}
+  Setup set_config = {0x00, 0x09, 0x01, 0, 0};
+  if(!usb_control(set_config, buf)){return false;}
+  usb_configured = true;
+
+  uint8_t coding[] = {0x00, 0xC2, 0x01, 0x00, 0, 0, 8}; // 115200 8N1
+  buf.assign(coding, coding + sizeof(coding));
+  Setup set_line_coding = {0x21, 0x20, 0, 0, sizeof(coding)};
+  if(!usb_control(set_line_coding, buf)){return false;}
+  Setup set_line_state = {0x21, 0x22, 0x03, 0, 0}; // DTR, RTS
+  if(!usb_control(set_line_state, buf)){return false;}
+
+  return run_until([]{return usb_mode == USB_CDC_ACTIVE;}, 10000000ULL);
+}
+
+// ---- main ----
+
+void boot(){
+  memset(regs, 0, sizeof(regs));
+  regs[A_P0] = regs[A_P1] = regs[A_P2] = regs[A_P3] = 0xFF;
+  in_isr = false;
+  now_ns = 0;
+  t3_count = 0; t3_last_ns = 0;
+  pca_base = 0; pca_base_ns = 0;
+  for(int i(0); i < 4; ++i){
+    ep[i].in_fifo.clear();
+    ep[i].out_fifo.clear();
+    ep[i].incsr1 = ep[i].incsr2 = ep[i].outcsr1 = ep[i].outcsr2 = 0;
+    ep[i].in_ready_ns = ep[i].out_sent_ns = 0;
+  }
+  usb_faddr = usb_power = usb_index = usb_clkrec = 0;
+  usb_in1int = usb_out1int = usb_cmint = usb_in1ie = usb_out1ie = usb_cmie = 0;
+  usb0adr = usb0dat = 0;
+  ep0_stall = ep0_dataend = usb_configured = false;
+  usb.in_paused = false;
+  usb.to_device.clear();
+  usb.from_device.clear();
+  usb.in_packets = usb.out_packets = 0;
+  bus_update();
+  global_ms = 0; // cleared by the startup code of the firmware
+  tickcount = 0;
+  stats_boot_us = 0;
+
+  // same as main()
+  port_init();
+  sysclk_init();
+  timer_init();
+  usb0_init();
+  EA = 1;
+  gpib_init();
+  stats_reset();
+}
+
+void loop(){
+  gpib_polling();
+  usb_polling();
+  stats_loop();
+}
+
+void run_for(uint64_t ns){
+  uint64_t until(now_ns + ns);
+  while(now_ns < until){loop();}
+}
+
+void send(const std::string &str){
+  usb.to_device.insert(usb.to_device.end(), str.begin(), str.end());
+}
+
+std::string receive(){
+  std::string res;
+  res.swap(usb.from_device);
+  return res;
+}
+
+bool receive_line(std::string &line, uint64_t timeout_ns){
+  if(!run_until([]{return usb.from_device.find('\n') != std::string::npos;}, timeout_ns)){
+    return false;
+  }
+  size_t n(usb.from_device.find('\n') + 1);
+  line = usb.from_device.substr(0, n);
+  usb.from_device.erase(0, n);
+  return true;
+}
+
+} // namespace sim
+
+// ---- Flash, whose address is a host pointer ----
+
+void flash_erase_page(flash_address_t addr){ // addr is the beginning of the page
+  u8 *p((u8 *)addr);
+  for(u16 i(0); i < FLASH_PAGESIZE; ++i){
+    if(p[i] == 0xFF){continue;}
+    memset(p, 0xFF, FLASH_PAGESIZE);
+    sim::flash.erases++; // only when not erased yet, as the firmware
+    break;
+  }
+}
+
+u16 flash_write(flash_address_t dst, u8 *src, u16 size){
+  u8 *p((u8 *)dst);
+  for(u16 i(0); i < size; ++i){p[i] &= src[i];} // only clears bits
+  sim::flash.writes++;
+  return size;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Simulator of the peripherals around the firmware built for host;
+ * time, Timer3, PCA0, GPIB bus through P0/P1/P2, and USB0 serial interface engine.
+ *
+ * The firmware runs in the caller's thread. Every SFR access advances the simulated time
+ * by access_ns, services the peripherals, and dispatches the pending interrupts
+ * (interrupt_timer3() and usb_isr()) as if they occurred between instructions.
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include "bus.h"
+
+namespace sim {
+
+extern unsigned access_ns; // time of an SFR access
+
+/**
+ * Host side of USB, which owns the other end of the endpoints.
+ * Control transfers are processed synchronously by running the firmware loop.
+ */
+struct Usb {
+  bool attached;
+  bool in_paused; // bulk IN data is not polled, as by a busy application
+  unsigned packet_ns; // time for a bulk packet on the wire
+  std::deque<uint8_t> to_device; // bulk OUT data waiting to be sent
+  std::string from_device; // bulk IN data received
+  uint64_t in_packets, out_packets;
+  Usb() : attached(false), in_paused(false), packet_ns(42000), in_packets(0), out_packets(0) {}
+};
+
+extern Usb usb;
+
+struct Setup {
+  uint8_t bmRequestType, bRequest;
+  uint16_t wValue, wIndex, wLength;
+};
+
+/**
+ * Execute a control transfer on EP0.
+ * @param data data stage; IN data is stored, and OUT data is sent
+ * @return false when stalled or timed out
+ */
+bool usb_control(const Setup &setup, std::vector<uint8_t> &data);
+
+// Standard enumeration followed by CDC SET_LINE_CODING and SET_CONTROL_LINE_STATE
+bool usb_enumerate();
+
+// Flash emulation counters; erases and writes are applied to the host variables directly.
+struct Flash {
+  unsigned erases, writes;
+  Flash() : erases(0), writes(0) {}
+};
+
+extern Flash flash;
+
+/**
+ * Request of software reset (RSTSRC.SWRSF), which is thrown
+ * because the firmware does not expect to return from it.
+ */
+struct SoftwareReset {};
+
+/**
+ * Reset the simulator and run the initialization sequence of main().
+ */
+void boot();
+
+// An iteration of the main loop
+void loop();
+
+// Run the main loop until the simulated time elapses or the condition is satisfied.
+void run_for(uint64_t ns);
+template <class F>
+bool run_until(F cond, uint64_t timeout_ns){
+  uint64_t until = now_ns + timeout_ns;
+  while(!cond()){
+    if(now_ns >= until){return false;}
+    loop();
+  }
+  return true;
+}
+
+// Send text to the adapter through USB, and receive the reply
+void send(const std::string &str);
+std::string receive(); // fetch and clear sim::usb.from_device
+bool receive_line(std::string &line, uint64_t timeout_ns = 1000000000ULL);
+
+} // namespace sim
+
+#endif /* __SIM_H__ */
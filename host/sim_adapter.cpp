@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Virtual adapter; the firmware built for host runs behind a pseudo terminal,
+ * which host applications open as if it were /dev/ttyACM*,
+ * and talks to virtual instruments on the simulated bus (see sim/instrument.h).
+ *
+ * usage: sim_adapter [options]
+ *   -l path          make a symbolic link to the pseudo terminal
+ *   -e pad           echo instrument
+ *   -s pad:file      scripted instrument; each line of file is "query<TAB>reply",
+ *                    and "\n" in reply is converted to LF
+ *   -b pad:size      binary block talker
+ *   -w pad:ns        slow listener, accepting a byte per ns
+ *   -q pad:stb:ns    SRQ asserter, requesting service ns after a trigger
+ *   -f               free running; the simulated time runs as fast as possible
+ *                    while there is input, instead of following the wall clock
+ *   -r file          record the input with the simulated time
+ *   -p file          replay the recorded input without pseudo terminal,
+ *                    and write the output to stdout; the result is deterministic
+ *
+ * Statistics are printed to stderr at exit (SIGINT/SIGTERM).
+ */
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "sim.h"
+#include "instrument.h"
+
+#include "mock_c8051f380.h"
+#include "stats.h"
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int){quit = 1;}
+
+static uint64_t wall_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static std::vector<sim::Instrument *> instruments;
+
+static bool parse_numbers(const char *arg, unsigned long long *v, int n, const char **rest = NULL){
+  for(int i(0); i < n; ++i){
+    char *end;
+    v[i] = strtoull(arg, &end, 0);
+    if(end == arg){return false;}
+    arg = end;
+    if(*arg == ':'){arg++;}
+    else if(i + 1 < n){return false;}
+  }
+  if(rest){*rest = arg;}
+  else if(*arg != '\0'){return false;}
+  return true;
+}
+
+static bool load_script(sim::ScriptedInstrument *dev, const char *fname){
+  std::ifstream in(fname);
+  if(!in){return false;}
+  std::string line;
+  while(std::getline(in, line)){
+    std::string::size_type tab(line.find('\t'));
+    if(tab == std::string::npos){continue;}
+    std::string reply(line.substr(tab + 1)), unescaped;
+    for(std::string::size_type i(0); i < reply.size(); ++i){
+      if((reply[i] == '\\') && (i + 1 < reply.size()) && (reply[i + 1] == 'n')){
+        unescaped += '\n';
+        i++;
+      }else{
+        unescaped += reply[i];
+      }
+    }
+    dev->respond(line.substr(0, tab), unescaped);
+  }
+  return true;
+}
+
+static void usage(const char *name){
+  fprintf(stderr,
+      "usage: %s [-l link] [-e pad] [-s pad:file] [-b pad:size] [-w pad:ns] [-q pad:stb:ns]\n"
+      "          [-f] [-r record_file | -p replay_file]\n", name);
+  exit(2);
+}
+
+static void start(){
+  sim::boot();
+  if(!sim::usb_enumerate()){
+    fprintf(stderr, "USB enumeration failed\n");
+    exit(1);
+  }
+  sim::receive();
+}
+
+// Run the firmware; a software reset (++rst) restarts it with the saved configuration.
+static void run_for(uint64_t ns){
+  try{
+    sim::run_for(ns);
+  }catch(sim::SoftwareReset &){
+    start();
+  }
+}
+
+struct Summary {
+  uint64_t bytes_in, bytes_out, lines_in, lines_out;
+  Summary() : bytes_in(0), bytes_out(0), lines_in(0), lines_out(0) {}
+  void input(const char *buf, size_t n){
+    bytes_in += n;
+    for(size_t i(0); i < n; ++i){if(buf[i] == '\n'){lines_in++;}}
+  }
+  void output(const std::string &str){
+    bytes_out += str.size();
+    for(size_t i(0); i < str.size(); ++i){if(str[i] == '\n'){lines_out++;}}
+  }
+  void print(uint64_t wall) const {
+    double sim_sec(sim::now_ns * 1E-9), wall_sec(wall * 1E-9);
+    fprintf(stderr,
+        "simulated %.3f s, wall %.3f s\n"
+        "input: %llu bytes, %llu lines; output: %llu bytes, %llu lines (%.1f lines/s simulated)\n"
+        "GPIB: written %u bytes, read %u bytes, timeout NRFD/NDAC/DAV %u/%u/%u\n",
+        sim_sec, wall_sec,
+        (unsigned long long)bytes_in, (unsigned long long)lines_in,
+        (unsigned long long)bytes_out, (unsigned long long)lines_out,
+        (sim_sec > 0) ? (lines_out / sim_sec) : 0.0,
+        stats.bytes_written, stats.bytes_read,
+        stats.timeout_nrfd, stats.timeout_ndac, stats.timeout_dav);
+  }
+};
+
+static int replay(const char *fname, Summary &summary){
+  FILE *in(fopen(fname, "r"));
+  if(!in){
+    perror(fname);
+    return 1;
+  }
+  unsigned long long at;
+  char hex[1024];
+  while(fscanf(in, "%llu %1023s", &at, hex) == 2){
+    std::string data;
+    for(const char *p(hex); p[0] && p[1]; p += 2){
+      unsigned int c;
+      sscanf(p, "%2x", &c);
+      data += (char)c;
+    }
+    if(at > sim::now_ns){run_for(at - sim::now_ns);}
+    summary.input(data.data(), data.size());
+    sim::send(data);
+    std::string out(sim::receive());
+    summary.output(out);
+    fwrite(out.data(), 1, out.size(), stdout);
+  }
+  fclose(in);
+  run_for(1000000000ULL); // drain
+  std::string out(sim::receive());
+  summary.output(out);
+  fwrite(out.data(), 1, out.size(), stdout);
+  return 0;
+}
+
+static int open_pty(const char *link){
+  int master(posix_openpt(O_RDWR | O_NOCTTY));
+  if((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0)){
+    perror("posix_openpt");
+    exit(1);
+  }
+  const char *slave_name(ptsname(master));
+
+  // raw mode, and keep the slave opened to survive the close by clients
+  int slave(open(slave_name, O_RDWR | O_NOCTTY));
+  struct termios tio;
+  if((slave < 0) || (tcgetattr(slave, &tio) != 0)){
+    perror(slave_name);
+    exit(1);
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+  if(link){
+    unlink(link);
+    if(symlink(slave_name, link) != 0){
+      perror(link);
+      exit(1);
+    }
+  }
+  printf("%s\n", link ? link : slave_name);
+  fflush(stdout);
+  return master;
+}
+
+int main(int argc, char *argv[]){
+  const char *link(NULL), *record_file(NULL), *replay_file(NULL);
+  bool free_running(false);
+  int opt;
+  while((opt = getopt(argc, argv, "l:e:s:b:w:q:fr:p:")) != -1){
+    unsigned long long v[3];
+    const char *rest;
+    switch(opt){
+      case 'l': link = optarg; break;
+      case 'e':
+        if(!parse_numbers(optarg, v, 1)){usage(argv[0]);}
+        instruments.push_back(new sim::EchoInstrument(v[0]));
+        break;
+      case 's': {
+        if(!parse_numbers(optarg, v, 1, &rest) || (*rest == '\0')){usage(argv[0]);}
+        sim::ScriptedInstrument *dev(new sim::ScriptedInstrument(v[0]));
+        if(!load_script(dev, rest)){
+          perror(rest);
+          return 1;
+        }
+        instruments.push_back(dev);
+        break;
+      }
+      case 'b':
+        if(!parse_numbers(optarg, v, 2)){usage(argv[0]);}
+        instruments.push_back(new sim::BlockTalker(v[0], v[1]));
+        break;
+      case 'w':
+        if(!parse_numbers(optarg, v, 2)){usage(argv[0]);}
+        instruments.push_back(new sim::SlowListener(v[0], v[1]));
+        break;
+      case 'q':
+        if(!parse_numbers(optarg, v, 3)){usage(argv[0]);}
+        instruments.push_back(new sim::SrqAsserter(v[0], v[1], v[2]));
+        break;
+      case 'f': free_running = true; break;
+      case 'r': record_file = optarg; break;
+      case 'p': replay_file = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  start();
+  for(size_t i(0); i < instruments.size(); ++i){sim::bus.attach(instruments[i]);}
+
+  Summary summary;
+  uint64_t wall_begin(wall_ns()), wall_start(wall_begin);
+
+  if(replay_file){
+    int res(replay(replay_file, summary));
+    summary.print(wall_ns() - wall_begin);
+    return res;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  FILE *record(NULL);
+  if(record_file && !(record = fopen(record_file, "w"))){
+    perror(record_file);
+    return 1;
+  }
+
+  int master(open_pty(link));
+  std::string pending_out;
+  uint64_t sim_start(sim::now_ns);
+  static const uint64_t slice_ns(1000000); // 1 ms
+
+  while(!quit){
+    bool busy(!sim::usb.to_device.empty());
+    uint64_t lag(0);
+    if(!free_running){
+      uint64_t target(sim_start + (wall_ns() - wall_start));
+      if(target > sim::now_ns){lag = target - sim::now_ns;}
+    }
+
+    struct pollfd pfd = {master, POLLIN, 0};
+    if(!pending_out.empty()){pfd.events |= POLLOUT;}
+    poll(&pfd, 1, (busy || (lag >= slice_ns)) ? 0 : 1);
+
+    if(pfd.revents & POLLIN){
+      char buf[4096];
+      ssize_t n(read(master, buf, sizeof(buf)));
+      if(n > 0){
+        summary.input(buf, n);
+        sim::send(std::string(buf, n));
+        if(record){
+          fprintf(record, "%llu ", (unsigned long long)sim::now_ns);
+          for(ssize_t i(0); i < n; ++i){fprintf(record, "%02x", (unsigned char)buf[i]);}
+          fprintf(record, "\n");
+        }
+      }
+    }
+
+    if(free_running){
+      run_for(slice_ns);
+    }else if(lag > 0){
+      run_for((lag > 10 * slice_ns) ? (10 * slice_ns) : lag);
+    }
+    if(free_running && !busy){ // follow the wall clock when idle, otherwise it spins
+      wall_start = wall_ns();
+      sim_start = sim::now_ns;
+    }
+
+    std::string out(sim::receive());
+    summary.output(out);
+    pending_out += out;
+    if(!pending_out.empty()){
+      ssize_t n(write(master, pending_out.data(), pending_out.size()));
+      if(n > 0){pending_out.erase(0, n);}
+      else if((n < 0) && (errno != EAGAIN) && (errno != EIO)){
+        perror("write");
+        break;
+      }
+    }
+  }
+
+  if(record){fclose(record);}
+  if(link){unlink(link);}
+  summary.print(wall_ns() - wall_begin);
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Decoder of the record stream of ++sniff mode.
+ * Each record has 4 bytes; flags, data, and the elapsed time from the previous byte
+ * in Timer3 count (0.25 us, little endian, 0xFFFF means 10 ms or more).
+ *
+ * usage: sniff_decode < captured_binary
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+
+#define SNIFF_ATN 0x02
+#define SNIFF_EOI 0x04
+#define SNIFF_IFC 0x40
+#define SNIFF_REN 0x80
+#define SNIFF_DELTA_OVER 0xFFFF
+#define SNIFF_COUNT_PER_US 4
+
+static void print_command(unsigned char c){
+  static const struct {
+    unsigned char code;
+    const char *name;
+  } table[] = {
+    {0x01, "GTL"}, {0x04, "SDC"}, {0x05, "PPC"}, {0x08, "GET"},
+    {0x09, "TCT"}, {0x11, "LLO"}, {0x14, "DCL"}, {0x15, "PPU"},
+    {0x18, "SPE"}, {0x19, "SPD"}, {0x3F, "UNL"}, {0x5F, "UNT"},
+  };
+  unsigned int i;
+  c &= 0x7F; // ignore parity
+  for(i = 0; i < sizeof(table) / sizeof(table[0]); i++){
+    if(table[i].code == c){
+      printf("%s", table[i].name);
+      return;
+    }
+  }
+  switch(c & 0x60){
+    case 0x20: printf("LAD %d", c & 0x1F); return;
+    case 0x40: printf("TAD %d", c & 0x1F); return;
+    case 0x60: printf("SAD %d", c & 0x1F); return;
+  }
+  printf("CMD 0x%02X", c);
+}
+
+static void print_data(unsigned char c){
+  if(isprint(c)){
+    printf("'%c'", c);
+  }else{
+    printf("0x%02X", c);
+  }
+}
+
+int main(){
+  unsigned char record[4];
+  unsigned long long elapsed_us4 = 0; // [0.25 us]
+  int lost = 0;
+
+  while(fread(record, sizeof(record), 1, stdin) == 1){
+    unsigned int delta = record[2] | ((unsigned int)record[3] << 8);
+    if(delta == SNIFF_DELTA_OVER){
+      lost = 1; // the absolute time is no longer exact.
+    }
+    elapsed_us4 += delta;
+    printf("%c%12.2f %-3s %-3s %-3s ",
+        (lost ? '~' : ' '),
+        (double)elapsed_us4 / SNIFF_COUNT_PER_US,
+        (record[0] & SNIFF_REN) ? "REN" : "",
+        (record[0] & SNIFF_IFC) ? "IFC" : "",
+        (record[0] & SNIFF_EOI) ? "EOI" : "");
+    if(record[0] & SNIFF_ATN){
+      print_command(record[1]);
+    }else{
+      print_data(record[1]);
+    }
+    printf("\n");
+  }
+  return 0;
+}
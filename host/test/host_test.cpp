@@ -0,0 +1,987 @@
+/*
+ * Copyright (c) 2015, M.Naruoka (fenrir)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the naruoka.org nor the names of its contributors
+ *   may be used to endorse or promote products derived from this software
+ *   without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Regression tests and throughput benchmarks of the firmware built for host,
+ * running against the simulated USB host and GPIB bus (see sim/sim.h).
+ *
+ * usage: host_test [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+#include "sim.h"
+#include "instrument.h"
+#include "lib/gpib_adapter.h"
+
+#include "mock_c8051f380.h"
+#include "f38x_usb.h"
+#include "gpib.h"
+#include "stats.h"
+
+static int failures = 0;
+static bool verbose = false;
+
+#define CHECK(cond) do{ \
+  if(!(cond)){ \
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    failures++; \
+  } \
+}while(0)
+
+#define CHECK_EQ(expected, actual) do{ \
+  if(!((expected) == (actual))){ \
+    fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed\n", __FILE__, __LINE__, #expected, #actual); \
+    failures++; \
+  } \
+}while(0)
+
+// boot and enumerate, then wait for the first periodic flush
+static bool setup(){
+  sim::bus.detach_all();
+  sim::boot();
+  if(!sim::usb_enumerate()){return false;}
+  sim::run_for(20000000ULL);
+  sim::receive();
+  return true;
+}
+
+static std::string query(const std::string &cmd){
+  std::string line;
+  sim::send(cmd);
+  if(!sim::receive_line(line)){return std::string("(timeout)");}
+  return line;
+}
+
+static void test_enumeration(){
+  CHECK(setup());
+  CHECK_EQ(USB_CDC_ACTIVE, usb_mode);
+
+  // boot-to-enumeration time, the last field of ++stats
+  CHECK(stats_boot_us > 0);
+  CHECK(stats_boot_us < 50000); // no fixed delay
+  std::string line(query("++stats\n"));
+  CHECK_EQ(std::to_string(stats_boot_us) + "\r\n", line.substr(line.rfind(' ') + 1));
+  fprintf(stderr, "boot to enumeration: %u us (simulated)\n", (unsigned)stats_boot_us);
+}
+
+static void test_version(){
+  setup();
+  CHECK_EQ(0u, query("++ver\n").find("Fenrir GPIB-USB"));
+}
+
+static void test_controller_write_read(){
+  setup();
+  sim::EchoInstrument dev(5);
+  sim::bus.attach(&dev);
+
+  sim::send("++addr 5\n*IDN?\n"); // sent with CR LF appended (++eos 0)
+  CHECK(sim::run_until([&]{return dev.messages > 0;}, 100000000ULL));
+  CHECK_EQ(std::string("*IDN?\r\n"), query("++read eoi\n"));
+
+  // with read-after-write
+  sim::send("++auto 1\n");
+  CHECK_EQ(std::string("MEAS?\r\n"), query("MEAS?\n"));
+
+  CHECK(stats.bytes_written > 0);
+  CHECK(stats.bytes_read > 0);
+  sim::bus.detach(&dev);
+}
+
+static void test_tx_pipelined(){
+  setup();
+  sim::ScriptedInstrument dmm(7);
+  dmm.respond("A?", "1\n").respond("B?", "22"); // "22" ends with EOI only
+  sim::Instrument partial(9), mute(11);
+  sim::bus.attach(&dmm);
+  sim::bus.attach(&partial);
+  sim::bus.attach(&mute);
+  partial.talk("part", false); // neither EOI nor terminator
+
+  // sent at once, and one line per tag is returned in order
+  sim::send("++read_tmo_ms 10\n"
+      "++tx 1 7\nA?\n++tx 2 7\nB?\n++tx 3 9\nX\n++tx 4 11\nY\n++tx 5 7\nA?\n"
+      "++tx 65534 7\nA?\n"); // negative as 16-bit int
+  static const char *expected[] = {"1 1\n", "2 22\r\n", "3 part\r\n", "4 \r\n", "5 1\n", "65534 1\n"};
+  for(unsigned i(0); i < sizeof(expected) / sizeof(expected[0]); ++i){
+    std::string line;
+    CHECK(sim::receive_line(line));
+    CHECK_EQ(std::string(expected[i]), line);
+  }
+  CHECK_EQ(4u, dmm.messages);
+
+  sim::bus.detach(&dmm);
+  sim::bus.detach(&partial);
+  sim::bus.detach(&mute);
+}
+
+static void test_tstamp(){
+  setup();
+  sim::EchoInstrument dev(5);
+  sim::bus.attach(&dev);
+
+  sim::send("++tstamp 1\n++addr 5\nHELLO\n");
+  CHECK(sim::run_until([&]{return dev.messages > 0;}, 100000000ULL));
+  std::string line(query("++read eoi\n"));
+  unsigned first(0), begin(0), end(0), mode(0);
+  char data[16] = {0};
+  CHECK(sscanf(line.c_str(), "%8x %15s", &first, data) == 2);
+  CHECK_EQ(std::string("HELLO"), std::string(data));
+  CHECK_EQ(std::string(" HELLO\r\n"), line.substr(8));
+  CHECK(first > 0);
+
+  line = query("++tstamp\n");
+  CHECK(sscanf(line.c_str(), "%u %8x %8x", &mode, &begin, &end) == 3);
+  CHECK_EQ(1u, mode);
+  CHECK_EQ(first, begin);
+  CHECK(end - begin > 0);
+  CHECK(end - begin < 1000); // 7 bytes
+
+  sim::send("++tstamp 0\n++addr 1\n");
+  sim::run_for(1000000ULL);
+  sim::bus.detach(&dev);
+}
+
+static void test_read_timeout(){
+  setup();
+  sim::Instrument dev(9); // listens, but never talks
+  sim::bus.attach(&dev);
+  sim::send("++addr 9\n++read_tmo_ms 50\n++read\n");
+  sim::run_for(200000000ULL);
+  CHECK_EQ(1u, stats.timeout_dav);
+  sim::bus.detach(&dev);
+}
+
+static void test_serial_poll(){
+  setup();
+  sim::Instrument dev(3);
+  sim::bus.attach(&dev);
+  dev.request_service(0x01);
+  CHECK_EQ(std::string("1\r\n"), query("++srq\n"));
+  CHECK_EQ(std::string("65\r\n"), query("++spoll 3\n"));
+  CHECK_EQ(std::string("0\r\n"), query("++srq\n"));
+  sim::bus.detach(&dev);
+}
+
+static void test_savecfg(){
+  setup();
+  unsigned writes(sim::flash.writes);
+  sim::send("++addr 12\n++savecfg\n");
+  sim::run_for(10000000ULL);
+  CHECK(sim::flash.writes > writes);
+  setup(); // reboot, which loads the saved config
+  CHECK_EQ(12, gpib_config.address.item[0][0]);
+  sim::send("++addr 1\n++savecfg\n"); // restore
+  sim::run_for(10000000ULL);
+}
+
+static void test_savecfg_wear_leveling(){
+  setup();
+  unsigned erases(sim::flash.erases);
+  for(int i(0); i < 20; ++i){
+    char buf[32];
+    snprintf(buf, sizeof(buf), "++addr %d\n++savecfg\n", 2 + i);
+    sim::send(buf);
+    sim::run_for(10000000ULL);
+  }
+  CHECK(sim::flash.erases - erases <= 3); // once per 8 saves, instead of every save
+
+  // written in background
+  sim::send("++addr 21\n++savecfg\n++savecfg status\n");
+  CHECK(query("") == "1\r\n");
+  CHECK(query("++savecfg status\n") == "0\r\n");
+  setup();
+  CHECK_EQ(21, gpib_config.address.item[0][0]);
+  sim::send("++addr 1\n++savecfg\n"); // restore
+  sim::run_for(10000000ULL);
+}
+
+// saves interrupted by reboot leave slots written partially, which are skipped
+static void test_savecfg_partial_slot(){
+  setup();
+  sim::send("++addr 7\n++profile save 0\n++addr 9\n++profile save 1\n");
+  sim::run_for(10000000ULL);
+  for(int i(0); i < 20; ++i){ // wraps the log twice
+    char buf[32];
+    snprintf(buf, sizeof(buf), "++addr %d\n++savecfg\n", 2 + i);
+    sim::send(buf);
+    if(i % 3 == 0){
+      unsigned writes(sim::flash.writes);
+      CHECK(sim::run_until([&]{return sim::flash.writes > writes;}, 10000000ULL)); // the first chunk only
+      setup();
+      CHECK_EQ(1 + i, gpib_config.address.item[0][0]); // the previous one
+    }else{
+      sim::run_for(10000000ULL);
+    }
+  }
+  setup();
+  CHECK_EQ(21, gpib_config.address.item[0][0]);
+  CHECK_EQ(std::string("1 1 0 0\r\n"), query("++profile\n"));
+  sim::send("++profile load 0\n");
+  sim::run_for(1000000ULL);
+  CHECK_EQ(7, gpib_config.address.item[0][0]);
+  sim::send("++profile load 1\n");
+  sim::run_for(1000000ULL);
+  CHECK_EQ(9, gpib_config.address.item[0][0]);
+  sim::send("++addr 1\n++savecfg\n"); // restore
+  sim::run_for(10000000ULL);
+}
+
+// Keeps every received message, LF terminated or not
+class CaptureListener : public sim::Instrument {
+public:
+  std::string data;
+  CaptureListener(uint8_t pad_) : sim::Instrument(pad_) {}
+protected:
+  void on_message(const std::string &msg){
+    Instrument::on_message(msg);
+    data += msg;
+  }
+};
+
+static void test_profile(){
+  setup();
+  sim::send("++addr 7\n++profile save 0\n");
+  sim::run_for(10000000ULL);
+  sim::send("++read_tmo_ms 10\n++mode 0\n++addr 9\n++profile save 1\n");
+  sim::run_for(500000000ULL); // saved step by step, each after waiting for the controller until timeout
+  CHECK_EQ(std::string("1 1 0 0\r\n"), query("++profile\n"));
+  sim::send("++mode 1\n");
+
+  for(int i(0); i < 20; ++i){ // wraps the log, which must keep the profiles
+    sim::send("++savecfg\n");
+    sim::run_for(10000000ULL);
+  }
+
+  sim::send("++profile load 0\n");
+  sim::run_for(1000000ULL);
+  CHECK_EQ(1, gpib_config.is_controller);
+  CHECK_EQ(7, gpib_config.address.item[0][0]);
+  sim::send("++profile load 1\n");
+  sim::run_for(1000000ULL);
+  CHECK_EQ(0, gpib_config.is_controller);
+  CHECK_EQ(9, gpib_config.address.item[0][0]);
+  CHECK_EQ(10, gpib_config.timeout_ms);
+  sim::send("++profile load 3\n"); // not saved, ignored
+  sim::run_for(1000000ULL);
+  CHECK_EQ(9, gpib_config.address.item[0][0]);
+
+  setup(); // reboot
+  CHECK_EQ(std::string("1 1 0 0\r\n"), query("++profile\n"));
+  sim::send("++profile load 0\n++addr 1\n++savecfg\n"); // restore
+  sim::run_for(10000000ULL);
+  CHECK_EQ(1, gpib_config.is_controller);
+
+  // the line being talked is ended with the configuration before loading
+  CaptureListener dev(5);
+  sim::bus.attach(&dev);
+  sim::send("++addr 9\n++eos 2\n++profile save 2\n++addr 5\n++eos 0\n");
+  sim::run_for(10000000ULL);
+  sim::send("ABC++profile load 2\n");
+  CHECK(sim::run_until([&]{return dev.messages > 0;}, 100000000ULL));
+  CHECK_EQ(std::string("\r\n"), dev.data.substr(dev.data.size() - 2));
+  CHECK_EQ(9, gpib_config.address.item[0][0]);
+  CHECK_EQ(2, gpib_config.eos);
+  sim::send("++addr 1\n++eos 0\n");
+  sim::run_for(1000000ULL);
+  sim::bus.detach(&dev);
+}
+
+static void test_soft_reset(){
+  setup();
+  unsigned out_packets(sim::usb.out_packets);
+  sim::send("++addr 12\n++tstamp 1\n++rst soft\n");
+  sim::run_for(10000000ULL);
+  CHECK_EQ(std::string("1\r\n"), query("++addr\n")); // reloaded from flash
+  CHECK_EQ(USB_CDC_ACTIVE, usb_mode); // not re-enumerated
+  CHECK(sim::usb.out_packets > out_packets);
+  CHECK_EQ(0u, query("++tstamp\n").find("0 "));
+
+  // performed after the line, and the lines pipelined behind it are kept
+  sim::send("++addr 12\r\n++rst soft\r\n++addr 13\r\n++addr\r\n");
+  std::string line;
+  CHECK(sim::receive_line(line));
+  CHECK_EQ(std::string("13\r\n"), line);
+  sim::send("++rst soft\n++eos 2\n++addr\n");
+  CHECK(sim::receive_line(line));
+  CHECK_EQ(std::string("1\n"), line);
+  sim::send("++eos 0\n");
+  sim::run_for(10000000ULL);
+
+  // also from a macro, whose rest is not replayed
+  sim::send("++macro def 0\n++rst soft\n++addr 14\n++macro end\n");
+  sim::run_for(10000000ULL);
+  sim::send("++addr 15\n++macro run 0\n");
+  sim::run_for(10000000ULL);
+  CHECK_EQ(std::string("1\r\n"), query("++addr\n"));
+  sim::send("++macro def 0\n++macro end\n"); // restore
+  sim::run_for(10000000ULL);
+}
+
+static void test_macro(){
+  setup();
+  sim::EchoInstrument dev(5);
+  sim::bus.attach(&dev);
+
+  sim::send("++read_tmo_ms 10\n++macro def 1\r\n++addr 5\r\n*IDN?\n++read eoi\n++ver\n++macro end\n");
+  CHECK_EQ(std::string("0 0\r\n"), query("++macro\n")); // saved in the background
+  CHECK_EQ(0u, dev.messages); // not executed
+  CHECK_EQ(1, gpib_config.address.item[0][0]);
+  sim::run_for(500000000ULL);
+  CHECK_EQ(std::string("0 33\r\n"), query("++macro\n"));
+
+  // replayed before the rest of the input, and replies are streamed back
+  sim::send("++macro run 1\n++addr\n");
+  std::string line;
+  CHECK(sim::receive_line(line) && (line == "*IDN?\r\n"));
+  CHECK(sim::receive_line(line) && (line.find("Fenrir GPIB-USB") == 0));
+  CHECK(sim::receive_line(line) && (line == "5\r\n"));
+  CHECK_EQ(1u, dev.messages);
+
+  // too long definition is discarded
+  std::string cmd("++macro def 0\n");
+  for(int i(0); i < 10; ++i){cmd += "*IDN?\n";}
+  sim::send(cmd + "++macro end\n");
+  sim::run_for(500000000ULL);
+  CHECK_EQ(std::string("0 33\r\n"), query("++macro\n"));
+  CHECK_EQ(1u, dev.messages);
+
+  sim::send("++addr 1\n++read_tmo_ms 10\n");
+  sim::run_for(1000000ULL);
+  sim::bus.detach(&dev);
+}
+
+static void test_many_args(){
+  setup();
+  std::string cmd("++addr");
+  for(int i(0); i < 40; ++i){ // more than PARSED_INFO_ARGS, whose rest is dropped
+    char buf[8];
+    snprintf(buf, sizeof(buf), " %d", 1 + (i % 30));
+    cmd += buf;
+  }
+  sim::send(cmd + "\n");
+  CHECK_EQ(0u, query("++ver\n").find("Fenrir GPIB-USB"));
+  CHECK_EQ(15, gpib_config.address.valid_items);
+  CHECK_EQ(15, gpib_config.address.item[14][0]);
+  sim::send("++addr 1\n");
+  sim::run_for(1000000ULL);
+}
+
+static void test_arg_forms(){
+  setup();
+  sim::send("++addr 0x0C\n++eot_char 0XfF\n++eos 0b10\n"); // eos 2 ends replies with LF
+  CHECK_EQ(std::string("12\n"), query("++addr\n"));
+  CHECK_EQ(std::string("255\n"), query("++eot_char\n"));
+  CHECK_EQ(std::string("2\n"), query("++eos\n"));
+  sim::send("++addr 0b12\n++addr 0xG\n++eos 0x\n"); // invalid digits
+  CHECK_EQ(std::string("12\n"), query("++addr\n"));
+  CHECK_EQ(std::string("2\n"), query("++eos\n"));
+  sim::send("++adr 5\n++addrr 5\n++a 5\n"); // not commands
+  CHECK_EQ(std::string("12\n"), query("++addr\n"));
+  CHECK_EQ(0u, query("++ver\n").find("Fenrir GPIB-USB"));
+  CHECK_EQ(std::string("0\r\n"), query("++read_tmo_ms 010\n++eos 0\n++eos\n")); // leading 0 is decimal
+  CHECK_EQ(std::string("10\r\n"), query("++read_tmo_ms\n"));
+  sim::send("++read_tmo_ms 65537\n++read_tmo_ms 0x10001\n++read_tmo_ms 0b00000000000001\n"); // overflow, longer than the token
+  CHECK_EQ(std::string("10\r\n"), query("++read_tmo_ms\n"));
+  sim::send("++addr 1\n++eot_char 0\n");
+  sim::run_for(1000000ULL);
+}
+
+// Replies to each trigger (GET) with a message
+class TriggeredTalker : public sim::Instrument {
+public:
+  std::string reply; // sent with EOI
+  TriggeredTalker(uint8_t pad_, const std::string &reply_ = "T\n")
+      : sim::Instrument(pad_), reply(reply_) {}
+protected:
+  void on_trigger(){
+    sim::Instrument::on_trigger();
+    talk(reply);
+  }
+};
+
+static void test_trg_read(){
+  setup();
+  TriggeredTalker dev5(5, "T"), dev6(6, "T"), dev7(7); // EOI only, except for 7
+  sim::bus.attach(&dev5);
+  sim::bus.attach(&dev6);
+  sim::bus.attach(&dev7);
+
+  // one line per device
+  sim::send("++read_tmo_ms 10\n++trg 5 6 7 read\n");
+  static const char *expected[] = {"5 T\r\n", "6 T\r\n", "7 T\n"};
+  for(unsigned i(0); i < sizeof(expected) / sizeof(expected[0]); ++i){
+    std::string line;
+    CHECK(sim::receive_line(line));
+    CHECK_EQ(std::string(expected[i]), line);
+  }
+  sim::bus.detach_all();
+}
+
+static void test_sched(){
+  setup();
+  TriggeredTalker dev(5);
+  sim::bus.attach(&dev);
+
+  // periods are rounded up to the 10 ms tick, in u16 beyond 16-bit int
+  sim::send("++read_tmo_ms 10\n++sched 1 32767 5\n++sched 2 65534 5 96\n++sched 3 15 5\n++sched 3 0\n");
+  sim::run_for(10000000ULL);
+  sim::receive(); // the first runs
+  CHECK_EQ(std::string("1 32770 5\r\n"), query("++sched\n"));
+  std::string line;
+  CHECK(sim::receive_line(line));
+  CHECK_EQ(std::string("2 65540 5 96\r\n"), line);
+  sim::send("++sched 1 0\n++sched 2 0\n");
+  sim::run_for(10000000ULL);
+  sim::receive();
+
+  // "<n> <device time in ms> <data>" every period
+  sim::send("++sched 0 50 5\n");
+  unsigned ms[3];
+  for(int i(0); i < 3; ++i){
+    unsigned n;
+    char data[8];
+    CHECK(sim::receive_line(line));
+    CHECK(sscanf(line.c_str(), "%u %u %7s", &n, &ms[i], data) == 3);
+    CHECK_EQ(0u, n);
+    CHECK_EQ(std::string("T"), std::string(data));
+  }
+  CHECK(ms[1] - ms[0] >= 40 && ms[1] - ms[0] <= 60);
+  CHECK(ms[2] - ms[1] >= 40 && ms[2] - ms[1] <= 60);
+  CHECK(dev.triggers >= 3);
+  sim::send("++sched 0 0\n");
+  sim::run_for(10000000ULL);
+  sim::receive();
+
+  // a line for each reply ended by EOI only
+  TriggeredTalker eoi_only(6, "T");
+  sim::bus.attach(&eoi_only);
+  sim::send("++sched 1 30 6\n");
+  for(int i(0); i < 3; ++i){
+    unsigned n, t;
+    char data[8];
+    CHECK(sim::receive_line(line));
+    CHECK(sscanf(line.c_str(), "%u %u %7s", &n, &t, data) == 3);
+    CHECK_EQ(1u, n);
+    CHECK_EQ(std::string(" T\r\n"), line.substr(line.rfind(' ')));
+  }
+  sim::send("++sched 1 0\n");
+  sim::run_for(10000000ULL);
+  sim::receive();
+  sim::bus.detach(&eoi_only);
+  sim::bus.detach(&dev);
+}
+
+static void test_capture(){
+  setup();
+  sim::Instrument talker(3); // talk-only
+  talker.talking = true;
+  sim::bus.attach(&talker);
+
+  // controller mode rejects it, as ++sniff
+  sim::send("++capture 1\n");
+  CHECK_EQ(0u, query("++capture\n++ver\n").find("Fenrir GPIB-USB"));
+
+  sim::send("++read_tmo_ms 10\n++mode 0\n++capture 1\n");
+  sim::run_for(10000000ULL);
+  sim::receive();
+  std::string data(sim::BlockTalker::payload(300));
+  talker.talk(data, false);
+  CHECK(sim::run_until([&]{return talker.output.empty();}, 1000000000ULL));
+  sim::run_for(100000000ULL); // flushed when idle
+  CHECK(sim::receive() == data);
+  std::string line(query("++capture\n"));
+  unsigned mode(0), overruns(1), hold(0xFFFF);
+  CHECK(sscanf(line.c_str(), "%u %u %u", &mode, &overruns, &hold) == 3);
+  CHECK_EQ(1u, mode);
+  CHECK_EQ(0u, overruns);
+  CHECK(hold < 10000);
+
+  // the mode switch stops it, whose ring is shared with ++sched jobs
+  sim::send("++mode 1\n++mode 0\n");
+  CHECK_EQ(std::string("0 0 0\r\n"), query("++capture\n"));
+  sim::send("++mode 1\n");
+  sim::run_for(1000000ULL);
+  sim::bus.detach(&talker);
+}
+
+// Asserts REN, as the system controller does
+struct RenDriver : public sim::Device {
+  void update(const sim::Bus &bus){ctrl_out = (uint8_t)~sim::REN;}
+};
+
+static void test_sniff(){
+  setup();
+  sim::Instrument talker(3), listener(4); // talk-only and listen-only
+  talker.talking = true;
+  listener.listening = true;
+  listener.accept_delay_ns = 2000;
+  RenDriver ren;
+  sim::bus.attach(&talker);
+  sim::bus.attach(&listener);
+  sim::bus.attach(&ren);
+
+  sim::send("++read_tmo_ms 10\n++mode 0\n++sniff 1\n");
+  sim::run_for(10000000ULL);
+  sim::receive();
+  talker.talk("ABC\r\n\x80");
+  CHECK(sim::run_until([&]{return talker.output.empty();}, 1000000000ULL));
+  sim::run_for(100000000ULL); // flushed when idle
+  CHECK_EQ(2u, listener.messages); // "ABC\r\n", and "\x80" with EOI
+
+  std::string records(sim::receive());
+  CHECK_EQ(6u * 4, records.size());
+  for(unsigned i(0); (i < 6) && ((i + 1) * 4 <= records.size()); ++i){
+    const unsigned char *r((const unsigned char *)records.data() + (i * 4));
+    unsigned delta(r[2] | (r[3] << 8));
+    CHECK_EQ((unsigned)(sim::REN | ((i == 5) ? sim::EOI : 0)), (unsigned)r[0]); // flags
+    CHECK_EQ((unsigned)(unsigned char)("ABC\r\n\x80"[i]), (unsigned)r[1]);
+    if(i == 0){
+      CHECK_EQ(0xFFFFu, delta); // since ++sniff 1, more than 10 ms
+    }else{ // a handshake with the accept delay, in 0.25 us
+      CHECK(delta >= 4);
+      CHECK(delta < 10000 * 4);
+    }
+  }
+  CHECK_EQ(std::string("1 0\r\n"), query("++sniff\n"));
+
+  sim::send("++sniff 0\n++mode 1\n");
+  sim::run_for(1000000ULL);
+  sim::bus.detach(&talker);
+  sim::bus.detach(&listener);
+  sim::bus.detach(&ren);
+}
+
+// the ring filled up while bulk IN is not polled, whose excess records are dropped
+static void test_sniff_full(){
+  setup();
+  sim::Instrument talker(3), listener(4);
+  talker.talking = true;
+  listener.listening = true;
+  listener.accept_delay_ns = 2000;
+  sim::bus.attach(&talker);
+  sim::bus.attach(&listener);
+
+  sim::send("++read_tmo_ms 10\n++mode 0\n++sniff 1\n");
+  sim::run_for(10000000ULL);
+  sim::receive();
+  sim::usb.in_paused = true;
+  talker.talk(std::string(100, 'D'));
+  CHECK(sim::run_until([&]{return talker.output.empty();}, 1000000000ULL));
+  sim::usb.in_paused = false;
+  sim::run_for(100000000ULL); // flushed when idle
+
+  std::string records(sim::receive());
+  CHECK_EQ(0u, records.size() % 4);
+  unsigned mode(0), drops(0);
+  CHECK(sscanf(query("++sniff\n").c_str(), "%u %u", &mode, &drops) == 2);
+  CHECK_EQ(100u, records.size() / 4 + drops);
+  CHECK(records.size() / 4 >= 255 / 4); // the ring is full, not lost
+  for(unsigned i(0); i + 4 <= records.size(); i += 4){
+    CHECK_EQ((unsigned)'D', (unsigned)(unsigned char)records[i + 1]);
+  }
+
+  sim::send("++sniff 0\n++mode 1\n");
+  sim::run_for(1000000ULL);
+  sim::bus.detach_all();
+}
+
+// ++savecfg is written to flash in ++sniff and ++capture as well, while the bus is idle
+static void test_savecfg_sniff(){
+  static const char *modes[] = {"++sniff", "++capture"};
+  for(unsigned i(0); i < sizeof(modes) / sizeof(modes[0]); ++i){
+    setup();
+    sim::send(std::string("++read_tmo_ms 10\n++mode 0\n") + modes[i] + " 1\n");
+    sim::run_for(10000000ULL);
+    unsigned writes(sim::flash.writes);
+    sim::send("++addr 12\n++savecfg\n");
+    sim::run_for(500000000ULL);
+    CHECK(sim::flash.writes > writes);
+    CHECK_EQ(std::string("0\r\n"), query("++savecfg status\n"));
+    setup(); // reboot, which loads the saved config
+    CHECK_EQ(0, gpib_config.is_controller);
+    CHECK_EQ(12, gpib_config.address.item[0][0]);
+    sim::send("++mode 1\n++addr 1\n++savecfg\n"); // restore
+    sim::run_for(10000000ULL);
+  }
+}
+
+static void test_mode_arena(){
+  setup();
+  sim::EchoInstrument dev(5);
+  sim::bus.attach(&dev);
+  sim::send("++read_tmo_ms 10\n++sched 0 60000 5\n");
+  sim::run_for(100000000ULL);
+  sim::receive(); // the first run, which times out
+  CHECK_EQ(std::string("0 60000 5\r\n"), query("++sched\n"));
+  sim::send("++mode 0\n++mode 1\n"); // the jobs share XRAM with the ring of device mode
+  CHECK_EQ(0u, query("++sched\n++ver\n").find("Fenrir GPIB-USB"));
+  sim::bus.detach(&dev);
+}
+
+static void test_multiple_instruments(){
+  setup();
+  sim::EchoInstrument echo(5);
+  sim::ScriptedInstrument dmm(7);
+  dmm.respond("*IDN?", "ACME,DMM100,0,1.0\n").respond("MEAS?", "+1.234E+00\n");
+  sim::BlockTalker scope(9, 1000);
+  sim::bus.attach(&echo);
+  sim::bus.attach(&dmm);
+  sim::bus.attach(&scope);
+
+  sim::send("++auto 1\n++addr 7\n");
+  CHECK_EQ(std::string("ACME,DMM100,0,1.0\n"), query("*IDN?\n"));
+  CHECK_EQ(std::string("+1.234E+00\n"), query("MEAS?\n"));
+  CHECK_EQ(0u, echo.messages);
+  CHECK_EQ(0u, scope.messages);
+
+  sim::send("++addr 5\n");
+  CHECK_EQ(std::string("hello\r\n"), query("hello\n"));
+  CHECK_EQ(2u, dmm.messages);
+
+  sim::bus.detach_all();
+}
+
+static void test_slow_listener(){
+  setup();
+  sim::SlowListener dev(11, 20000); // 20 us per byte
+  sim::bus.attach(&dev);
+  sim::send("++addr 11\n");
+  sim::run_for(10000000ULL);
+
+  uint64_t start(sim::now_ns);
+  for(int i(0); i < 16; ++i){sim::send(std::string(62, 'S') + "\n");} // 1024 bytes with CR
+  CHECK(sim::run_until([&]{return dev.bytes >= 1024;}, 1000000000ULL));
+  CHECK(sim::now_ns - start >= 1024 * 20000ULL);
+  CHECK_EQ(0u, stats.timeout_ndac);
+
+  // slower than ++read_tmo_ms
+  dev.accept_delay_ns = 50000000ULL;
+  sim::send("++read_tmo_ms 20\nX\n");
+  sim::run_for(200000000ULL);
+  CHECK(stats.timeout_ndac > 0);
+  sim::bus.detach(&dev);
+}
+
+static void test_binary_block(){
+  setup();
+  sim::BlockTalker dev(9, 4096);
+  sim::bus.attach(&dev);
+  sim::send("++addr 9\nCURVE?\n");
+  CHECK(sim::run_until([&]{return dev.messages > 0;}, 100000000ULL));
+  std::string expected(sim::BlockTalker::block(4096));
+  sim::send("++read eoi\n");
+  CHECK(sim::run_until([&]{return sim::usb.from_device.size() >= expected.size();}, 1000000000ULL));
+  CHECK(sim::receive() == expected);
+  sim::bus.detach(&dev);
+}
+
+static void test_host_escape(){
+  setup();
+  CaptureListener dev(13);
+  sim::bus.attach(&dev);
+  std::string data("a+b\r\n\x1b++addr 1\r\n");
+  data += '\0';
+  // the last byte is marked by EOI instead of a terminator
+  sim::send("++addr 13\n++eos 3\n++eoi 1\n" + gpib_usb::Adapter::escape(data) + "\n");
+  CHECK(sim::run_until([&]{return dev.data.size() >= data.size();}, 100000000ULL));
+  CHECK(dev.data == data);
+  CHECK_EQ(13, gpib_config.address.item[0][0]); // "++addr 1" was data
+  sim::send("++eos 0\n++eoi 0\n");
+  sim::bus.detach(&dev);
+}
+
+// output of the host library through a pseudo terminal, whose other side is driven by hand
+static std::string pty_read(int master, size_t size){
+  std::string res;
+  char buf[256];
+  while(res.size() < size){
+    ssize_t n(read(master, buf, sizeof(buf)));
+    if(n <= 0){break;}
+    res.append(buf, n);
+  }
+  return res;
+}
+
+static void test_adapter_tx(){
+  setup();
+  sim::ScriptedInstrument dmm(7);
+  dmm.respond("A?", "1\n");
+  sim::Instrument cr_talker(12); // replies ended by CR
+  cr_talker.talk("3\r");
+  cr_talker.talk("4\r");
+  sim::bus.attach(&dmm);
+  sim::bus.attach(&cr_talker);
+  sim::send("++read_tmo_ms 10\n");
+  sim::run_for(1000000ULL);
+  sim::receive();
+
+  int master(posix_openpt(O_RDWR | O_NOCTTY));
+  CHECK((master >= 0) && (grantpt(master) == 0) && (unlockpt(master) == 0));
+  if(master < 0){return;}
+  {
+    gpib_usb::Adapter adapter(ptsname(master));
+
+    // no device at 11; its empty reply keeps the following one matched
+    uint64_t t0(adapter.submit(7, "A?")), t1(adapter.submit(11, "B?")), t2(adapter.submit(7, "A?"));
+    adapter.flush();
+    std::string expected("++tx 0 7\nA?\n++tx 1 11\nB?\n++tx 2 7\nA?\n");
+    std::string sent(pty_read(master, expected.size()));
+    CHECK_EQ(expected, sent);
+    sim::send(sent);
+    std::string replies;
+    for(int i(0); i < 3; ++i){
+      std::string line;
+      CHECK(sim::receive_line(line));
+      replies += line;
+    }
+    CHECK_EQ(std::string("0 1\n1 \r\n2 1\n"), replies);
+    CHECK(write(master, replies.data(), replies.size()) == (ssize_t)replies.size());
+    CHECK_EQ(std::string("1\n"), adapter.wait(t0, 1000));
+    CHECK_EQ(std::string("\r\n"), adapter.wait(t1, 1000));
+    CHECK_EQ(std::string("1\n"), adapter.wait(t2, 1000));
+
+    // a reply lost before a later tag, and a stray line
+    uint64_t t3(adapter.submit(7, "A?")), t4(adapter.submit(7, "A?"));
+    adapter.flush();
+    pty_read(master, 2 * std::string("++tx 3 7\nA?\n").size());
+    std::string input("stray\n4 1\n");
+    CHECK(write(master, input.data(), input.size()) == (ssize_t)input.size());
+    CHECK_EQ(std::string("1\n"), adapter.wait(t4, 1000));
+    bool lost(false);
+    try{
+      adapter.wait(t3, 0);
+    }catch(gpib_usb::Error &){
+      lost = true;
+    }
+    CHECK(lost);
+
+    // replies ended by CR only under ++eos 1
+    sim::send("++eos 1\n");
+    sim::run_for(1000000ULL);
+    uint64_t t5(adapter.submit(12, "C?", gpib_usb::Adapter::FRAME_LINE_CR));
+    uint64_t t6(adapter.submit(11, "C?", gpib_usb::Adapter::FRAME_LINE_CR));
+    uint64_t t7(adapter.submit(12, "C?", gpib_usb::Adapter::FRAME_LINE_CR));
+    adapter.flush();
+    sim::send(pty_read(master, 3 * std::string("++tx 5 12\nC?\n").size()));
+    CHECK(sim::run_until([]{return sim::usb.from_device.size() >= 11;}, 100000000ULL));
+    replies = sim::receive();
+    CHECK_EQ(std::string("5 3\r6 \r7 4\r"), replies);
+    CHECK(write(master, replies.data(), replies.size()) == (ssize_t)replies.size());
+    CHECK_EQ(std::string("3\r"), adapter.wait(t5, 1000));
+    CHECK_EQ(std::string("\r"), adapter.wait(t6, 1000));
+    CHECK_EQ(std::string("4\r"), adapter.wait(t7, 1000));
+    sim::send("++eos 0\n");
+    sim::run_for(1000000ULL);
+
+    // a block or a line, which may be an LF only
+    uint64_t t8(adapter.submit(11, "D?", gpib_usb::Adapter::FRAME_BLOCK));
+    uint64_t t9(adapter.submit(7, "A?", gpib_usb::Adapter::FRAME_BLOCK));
+    adapter.flush();
+    pty_read(master, std::string("++tx 8 11\nD?\n++tx 9 7\nA?\n").size());
+    input = "8 \n";
+    CHECK(write(master, input.data(), input.size()) == (ssize_t)input.size());
+    CHECK_EQ(std::string("\n"), adapter.wait(t8, 1000));
+    input = "9 #15ABCDE\n";
+    CHECK(write(master, input.data(), input.size()) == (ssize_t)input.size());
+    CHECK_EQ(std::string("#15ABCDE\n"), adapter.wait(t9, 1000));
+  }
+  close(master);
+  sim::bus.detach(&dmm);
+  sim::bus.detach(&cr_talker);
+}
+
+static void test_srq_multiple(){
+  setup();
+  sim::SrqAsserter dev3(3, 0x01, 1000000); // 1 ms
+  sim::SrqAsserter dev4(4, 0x02, 5000000); // 5 ms
+  sim::bus.attach(&dev3);
+  sim::bus.attach(&dev4);
+  CHECK_EQ(std::string("0\r\n"), query("++srq\n"));
+  sim::send("++trg 3 4\n");
+  sim::run_for(10000000ULL);
+  CHECK_EQ(1u, dev3.triggers);
+  CHECK_EQ(1u, dev4.triggers);
+  CHECK_EQ(std::string("1\r\n"), query("++srq\n"));
+  CHECK_EQ(std::string("66\r\n"), query("++spoll 4\n"));
+  CHECK_EQ(std::string("1\r\n"), query("++srq\n"));
+  CHECK_EQ(std::string("65\r\n"), query("++spoll 3\n"));
+  CHECK_EQ(std::string("0\r\n"), query("++srq\n"));
+  sim::bus.detach_all();
+}
+
+// ---- benchmarks ----
+
+static double wall_sec(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+static void report(const char *name, size_t bytes, uint64_t sim_ns, double wall){
+  printf("%-10s %8zu bytes, %10.1f kB/s simulated, %8.3f s wall\n",
+      name, bytes, (double)bytes / (sim_ns * 1E-9) / 1E3, wall);
+}
+
+static void bench_write(){
+  setup();
+  sim::Instrument dev(5);
+  sim::bus.attach(&dev);
+  sim::send("++addr 5\n");
+  sim::run_for(10000000ULL);
+
+  const size_t size(0x10000);
+  std::string line(63, 'A');
+  line += '\n';
+  stats_reset();
+  uint64_t start(sim::now_ns);
+  double wall(wall_sec());
+  for(size_t i(0); i < size; i += line.size()){sim::send(line);}
+  CHECK(sim::run_until([&]{return stats.bytes_written >= size;}, 10000000000ULL));
+  report("write", size, sim::now_ns - start, wall_sec() - wall);
+  sim::bus.detach(&dev);
+}
+
+static void bench_read(){
+  setup();
+  sim::Instrument dev(5);
+  sim::bus.attach(&dev);
+  sim::send("++addr 5\n");
+  sim::run_for(10000000ULL);
+
+  const size_t size(0x10000);
+  dev.talk(std::string(size - 1, 'B') + "\n");
+  stats_reset();
+  uint64_t start(sim::now_ns);
+  double wall(wall_sec());
+  sim::send("++read eoi\n");
+  CHECK(sim::run_until([&]{return sim::usb.from_device.size() >= size;}, 10000000000ULL));
+  report("read", size, sim::now_ns - start, wall_sec() - wall);
+  sim::bus.detach(&dev);
+}
+
+// one million bytes each way, which should take seconds, not minutes
+static void bench_million(){
+  const size_t size(1000000);
+  setup();
+  sim::BlockTalker talker(9, size);
+  sim::SlowListener listener(10, 0);
+  sim::bus.attach(&talker);
+  sim::bus.attach(&listener);
+
+  sim::send("++addr 9\nDATA?\n");
+  CHECK(sim::run_until([&]{return talker.messages > 0;}, 100000000ULL));
+  std::string expected(sim::BlockTalker::block(size));
+  uint64_t start(sim::now_ns);
+  double wall(wall_sec());
+  sim::send("++read eoi\n");
+  CHECK(sim::run_until([&]{return sim::usb.from_device.size() >= expected.size();}, 100000000000ULL));
+  report("read 1M", expected.size(), sim::now_ns - start, wall_sec() - wall);
+  CHECK(sim::receive() == expected);
+
+  sim::send("++addr 10\n");
+  sim::run_for(10000000ULL);
+  std::string line(62, 'W');
+  line += '\n'; // 64 bytes on the bus with CR
+  start = sim::now_ns;
+  wall = wall_sec();
+  for(size_t i(0); i < size; i += 64){sim::send(line);}
+  CHECK(sim::run_until([&]{return listener.bytes >= size;}, 100000000000ULL));
+  report("write 1M", listener.bytes, sim::now_ns - start, wall_sec() - wall);
+  if(verbose){
+    printf("bus resolves: %llu\n", (unsigned long long)sim::bus.resolves);
+  }
+  sim::bus.detach_all();
+}
+
+int main(int argc, char *argv[]){
+  for(int i(1); i < argc; ++i){
+    if(strcmp(argv[i], "-v") == 0){verbose = true;}
+  }
+
+  struct {
+    const char *name;
+    void (*func)();
+  } tests[] = {
+    {"enumeration", test_enumeration},
+    {"version", test_version},
+    {"controller_write_read", test_controller_write_read},
+    {"tstamp", test_tstamp},
+    {"read_timeout", test_read_timeout},
+    {"tx_pipelined", test_tx_pipelined},
+    {"serial_poll", test_serial_poll},
+    {"savecfg", test_savecfg},
+    {"savecfg_wear_leveling", test_savecfg_wear_leveling},
+    {"savecfg_partial_slot", test_savecfg_partial_slot},
+    {"profile", test_profile},
+    {"soft_reset", test_soft_reset},
+    {"macro", test_macro},
+    {"many_args", test_many_args},
+    {"arg_forms", test_arg_forms},
+    {"trg_read", test_trg_read},
+    {"sched", test_sched},
+    {"capture", test_capture},
+    {"sniff", test_sniff},
+    {"sniff_full", test_sniff_full},
+    {"savecfg_sniff", test_savecfg_sniff},
+    {"mode_arena", test_mode_arena},
+    {"multiple_instruments", test_multiple_instruments},
+    {"slow_listener", test_slow_listener},
+    {"binary_block", test_binary_block},
+    {"srq_multiple", test_srq_multiple},
+    {"host_escape", test_host_escape},
+    {"adapter_tx", test_adapter_tx},
+    {"bench_write", bench_write},
+    {"bench_read", bench_read},
+    {"bench_million", bench_million},
+  };
+  for(unsigned i(0); i < sizeof(tests) / sizeof(tests[0]); ++i){
+    int failures_before(failures);
+    try{
+      tests[i].func();
+    }catch(sim::SoftwareReset &){
+      fprintf(stderr, "%s: unexpected software reset\n", tests[i].name);
+      failures++;
+    }
+    if(verbose || (failures != failures_before)){
+      printf("%s: %s\n", tests[i].name, (failures == failures_before) ? "OK" : "FAILED");
+    }
+  }
+
+  printf("%s (%d failure(s))\n", failures ? "FAILED" : "PASSED", failures);
+  return failures ? 1 : 0;
+}
@@ -2,8 +2,9 @@
 set -ev
 : ${SDCC:=3.3.0}
 : ${SDCC_DIR:=/usr/local}
+: ${UCSIM:=0} # 1 also builds the simulators, s51 is required by "make bench"
 
-if [[ $(sdcc --version) =~ "${SDCC}" ]]; then
+if [[ $(sdcc --version) =~ "${SDCC}" ]] && { [ "${UCSIM}" != "1" ] || command -v s51 > /dev/null; }; then
   echo "Found sdcc-${SDCC}, build skipped."
   exit 0
 fi
@@ -123,7 +124,10 @@ __PATCH_LINE__
 esac
 
 DISABLE_DEVICES="z80 z180 r2k r3ka gbz80 ds390 ds400 pic14 pic16 hc08 s08"
-CONFIGURE_OPT="--prefix=${SDCC_DIR} --disable-ucsim --disable-sdcdb --disable-non-free" 
+CONFIGURE_OPT="--prefix=${SDCC_DIR} --disable-sdcdb --disable-non-free" 
+if [ "${UCSIM}" != "1" ]; then
+  CONFIGURE_OPT+=" --disable-ucsim"
+fi
 case "${SDCC}" in
 3.[45678].*)
 DISABLE_DEVICES+=" tlcs90 stm8";;